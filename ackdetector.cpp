@@ -0,0 +1,182 @@
+/*
+    This file is part of wavedcc,
+    Copyright (C) 2021 Glenn Butcher.
+
+    wavedcc is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    wavedcc is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with wavedcc.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <math.h>
+
+#include <vector>
+#include <algorithm>
+
+#include "ackdetector.h"
+
+Baseline::Baseline(unsigned size)
+{
+	n = size;
+	stale = true;
+	med = mad = 0.0;
+}
+
+void Baseline::add(float c)
+{
+	window.push_back(c);
+	if (window.size() > n) window.pop_front();
+	stale = true;
+}
+
+void Baseline::clear()
+{
+	window.clear();
+	stale = true;
+}
+
+unsigned Baseline::count()
+{
+	return window.size();
+}
+
+float Baseline::median()
+{
+	if (stale) update();
+	return med;
+}
+
+float Baseline::noise()
+{
+	if (stale) update();
+	return 1.4826 * mad;
+}
+
+//both are recomputed only when asked for after a change; at 64 samples, the two partial sorts
+//are cheap next to the I2C transactions that produced the samples:
+void Baseline::update()
+{
+	stale = false;
+	if (window.size() == 0) {
+		med = mad = 0.0;
+		return;
+	}
+	std::vector<float> v(window.begin(), window.end());
+	std::nth_element(v.begin(), v.begin() + v.size()/2, v.end());
+	med = v[v.size()/2];
+	for (unsigned i=0; i<v.size(); i++) v[i] = fabs(v[i] - med);
+	std::nth_element(v.begin(), v.begin() + v.size()/2, v.end());
+	mad = v[v.size()/2];
+}
+
+
+AckDetector::AckDetector(Baseline &baseline, ackparams &params, uint64_t settletime, uint64_t windowopen, uint64_t windowclose) : b(baseline)
+{
+	p = params;
+	settle = settletime;
+	open = windowopen;
+	close = windowclose;
+	prev = edge = 0;
+	base = thresh = sum = 0.0;
+	n = count = widest = 0;
+	maxack = evidence = 0.0;
+	windowsamples = 0;
+	acked = false;
+}
+
+bool AckDetector::sample(float c, uint64_t t)
+{
+	uint64_t last = prev ? prev : t;
+	prev = t;
+	if (t < settle) return false;
+	if (t >= open) windowsamples++;
+
+	if (edge == 0) {  //looking for a rising edge
+		float m = b.median();
+		float th = std::max(p.limit, p.sigma * b.noise());
+		if ((t >= open) & (b.count() > 0) & (c > m + th)) {
+			//the rise happened somewhere after the last sample, so that's where the width starts:
+			edge = last;
+			base = m;
+			thresh = th;
+			sum = c;
+			n = 1;
+			count++;
+			maxack = std::max(maxack, c);
+		}
+		else {
+			b.add(c);
+			if (t > close) return true; //window closed, no ack in progress
+			return false;
+		}
+	}
+	else if (c > base + thresh/2) {  //plateau continues
+		sum += c;
+		n++;
+		count++;
+		maxack = std::max(maxack, c);
+	}
+	else {  //plateau fell before confirmation, a spike
+		int w = last - edge;
+		widest = std::max(widest, w);
+		float amp = sum/n - base;
+		evidence = std::max(evidence, std::min(1.0f, (float) w / p.minwidth) * std::min(1.0f, amp / p.limit));
+		edge = 0;
+		b.add(c);
+		if (t > close) return true;
+		return false;
+	}
+
+	if ((int) (t - edge) >= p.minwidth) {  //S-9.2.3 6ms +/- 1ms
+		acked = true;
+		widest = t - edge;
+		return true;
+	}
+	return false;
+}
+
+bool AckDetector::ack()
+{
+	return acked;
+}
+
+//For an ack, the product of the amplitude relative to limit and the separation from the baseline
+//relative to twice sigma noise standard deviations, each capped at 1.  For no ack, 1 less the
+//strongest partial evidence of an ack, the spikes scored by width relative to minwidth and
+//amplitude relative to limit.  No samples in the window at all is no evidence either way.
+float AckDetector::confidence()
+{
+	if (acked) {
+		float amp = sum/n - base;
+		float sd = b.noise();
+		float fa = std::min(1.0f, amp / p.limit);
+		float fs = 1.0;
+		if ((sd > 0.0) & (p.sigma > 0.0)) fs = std::min(1.0f, amp / (2 * p.sigma * sd));
+		return std::max(0.0f, fa * fs);
+	}
+	if (windowsamples == 0) return 0.0;
+	return 1.0 - evidence;
+}
+
+int AckDetector::pwrcount()
+{
+	return count;
+}
+
+float AckDetector::max()
+{
+	return maxack;
+}
+
+int AckDetector::width()
+{
+	return widest;
+}
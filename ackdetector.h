@@ -0,0 +1,94 @@
+/*
+    This file is part of wavedcc,
+    Copyright (C) 2021 Glenn Butcher.
+
+    wavedcc is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    wavedcc is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with wavedcc.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __ACKDETECTOR_H__
+#define __ACKDETECTOR_H__
+
+#include <stdint.h>
+#include <deque>
+
+//Running estimate of the quiescent current and its noise, the median and the median absolute
+//deviation (MAD) of the last size samples that weren't part of an ack.  Unlike the maximum of the
+//tail samples, neither is pulled up by the occasional spike from a sound decoder.
+class Baseline
+{
+public:
+	explicit Baseline(unsigned size=64);
+
+	void add(float c);
+	void clear();
+	unsigned count();
+
+	float median();
+	float noise(); //1.4826 * MAD, the MAD scaled to estimate the standard deviation
+
+private:
+	void update();
+
+	std::deque<float> window;
+	unsigned n;
+	bool stale;
+	float med, mad;
+};
+
+struct ackparams {
+	float limit;	//milliamps over the baseline to start an ack, S-9.2.3 60ma
+	float sigma;	//minimum ack amplitude in baseline noise standard deviations
+	int minwidth;	//microseconds an ack has to hold to be confirmed, S-9.2.3 6ms - 1ms
+};
+
+//Ack detector, fed the timestamped current samples while a service mode chain is transmitting,
+//so the chain can be stopped as soon as the outcome is known.
+//
+//An ack starts with a rising edge of at least the larger of limit and sigma noise standard
+//deviations over the baseline, and holds a plateau above half that until confirmed at minwidth.
+//A plateau that falls before minwidth is a spike, and is discarded.  Samples before the window
+//opens, and ones in the window that aren't part of a plateau, are added to the baseline, so it
+//follows a drifting quiescent current.  The outcome is decided when an ack is confirmed, or when
+//the window closes with no plateau in progress.
+//
+//Samples before settle, the power-on inrush at the head of the chain, are ignored.
+class AckDetector
+{
+public:
+	AckDetector(Baseline &baseline, ackparams &params, uint64_t settletime, uint64_t windowopen, uint64_t windowclose);
+
+	//returns true when the outcome is decided:
+	bool sample(float c, uint64_t t);
+
+	bool ack();
+	float confidence(); //0.0-1.0, the strength of the evidence for the outcome
+	int pwrcount();	//samples over the threshold
+	float max();	//maximum sample in a plateau
+	int width();	//microseconds, width of the confirmed ack, or the widest spike
+
+private:
+	Baseline &b;
+	ackparams p;
+	uint64_t settle, open, close, prev;
+	uint64_t edge;		//timestamp of the rising edge of the plateau in progress, 0 if none
+	float base, thresh;	//baseline and threshold at the rising edge
+	float sum;		//accumulator for the plateau mean
+	int n;			//samples in the plateau
+	int count, widest;
+	int windowsamples;
+	float maxack, evidence;
+	bool acked;
+};
+
+#endif
@@ -0,0 +1,85 @@
+/*
+    This file is part of wavedcc,
+    Copyright (C) 2021 Glenn Butcher.
+
+    wavedcc is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    wavedcc is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with wavedcc.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __ADS1115_H__
+#define __ADS1115_H__
+
+#include "i2csensor.h"
+
+#define ADS1115_CONVERSION_REG	0x00
+#define ADS1115_CONFIG_REG	0x01
+
+//TI ADS1115 16-bit ADC, for current sensors with a voltage output, e.g., an amplified shunt or a
+//hall effect sensor like the ACS712.  The ADC runs continuously at 860 samples/second, and the
+//current is (input millivolts - offset) / millivolts per amp.  There's no bus voltage 
+//measurement; get_voltage() returns 0.
+class ADS1115 : public I2CSensor
+{
+public:
+	//input is "0"-"3" for single ended, "01", "03", "13" or "23" for differential; fullscale is
+	//the PGA range in millivolts, 6144, 4096, 2048, 1024, 512 or 256, rounded up to one of those:
+	ADS1115(std::string input="01", int fullscale=2048, float mvperamp=100.0, float offset=0.0)
+	{
+		static const char *inputs[8] = { "01", "03", "13", "23", "0", "1", "2", "3" };
+		static const int ranges[6] = { 6144, 4096, 2048, 1024, 512, 256 };
+		int mux = 0, pga = 0;
+		for (int i=0; i<8; i++) if (input == inputs[i]) mux = i;
+		for (int i=0; i<6; i++) if (ranges[i] >= fullscale) pga = i;
+		fs = ranges[pga];
+		mv_per_amp = mvperamp;
+		offset_mv = offset;
+		//continuous conversion, 860 samples/second, comparator off:
+		config = (mux << 12) | (pga << 9) | (0x7 << 5) | 0x0003;
+	}
+
+	float get_current()
+	{
+		short raw;
+		if ( register_read( ADS1115_CONVERSION_REG, (unsigned short*)&raw ) != 0 ) return -1;
+		float mv = raw * fs / 32768.0;
+		return (mv - offset_mv) / mv_per_amp * 1000.0;
+	}
+
+	float get_voltage()
+	{
+		return 0.0;
+	}
+
+	int conversion_micros()
+	{
+		return 1163;
+	}
+
+	std::string name()
+	{
+		return "ads1115";
+	}
+
+protected:
+	void setup()
+	{
+		register_write( ADS1115_CONFIG_REG, config );
+	}
+
+private:
+	unsigned short config;
+	int fs;
+	float mv_per_amp, offset_mv;
+};
+
+#endif
@@ -0,0 +1,182 @@
+/*
+    This file is part of wavedcc,
+    Copyright (C) 2021 Glenn Butcher.
+
+    wavedcc is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    wavedcc is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with wavedcc.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <time.h>
+
+#include "currenthistory.h"
+
+CurrentHistory::CurrentHistory()
+{
+}
+
+CurrentHistory::~CurrentHistory()
+{
+	for (unsigned i=0; i<t.size(); i++) {
+		delete [] t[i]->slots;
+		delete t[i];
+	}
+}
+
+void CurrentHistory::addTier(unsigned period, unsigned size)
+{
+	tier *tr = new tier;
+	tr->period = (uint64_t) period * 1000;
+	tr->n = size;
+	tr->slots = new slot[size];
+	for (unsigned i=0; i<size; i++) tr->slots[i].seq = 0;
+	tr->next = 0;
+	tr->acc.count = 0;
+	tr->csum = tr->vsum = 0.0;
+	t.push_back(tr);
+}
+
+void CurrentHistory::push(tier &tr, const historyrecord &r)
+{
+	uint64_t n = tr.next.load(std::memory_order_relaxed);
+	slot &sl = tr.slots[n % tr.n];
+	sl.seq.store(0, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	sl.tstamp.store(r.tstamp, std::memory_order_relaxed);
+	sl.count.store(r.count, std::memory_order_relaxed);
+	sl.min.store(r.min, std::memory_order_relaxed);
+	sl.max.store(r.max, std::memory_order_relaxed);
+	sl.mean.store(r.mean, std::memory_order_relaxed);
+	sl.voltage.store(r.voltage, std::memory_order_relaxed);
+	sl.seq.store(n+1, std::memory_order_release);
+	tr.next.store(n+1, std::memory_order_release);
+}
+
+//adds r to tier k's period in progress; a record past the end of the period completes it, and
+//the completed record is pushed to tier k and passed on to tier k+1:
+void CurrentHistory::accumulate(unsigned k, const historyrecord &r)
+{
+	if (k >= t.size()) return;
+	tier &tr = *t[k];
+	uint64_t start = r.tstamp - r.tstamp % tr.period;
+	if ((tr.acc.count > 0) & (start != tr.acc.tstamp)) {
+		tr.acc.mean = tr.csum / tr.acc.count;
+		tr.acc.voltage = tr.vsum / tr.acc.count;
+		push(tr, tr.acc);
+		historyrecord done = tr.acc;
+		tr.acc.count = 0;
+		accumulate(k+1, done);
+	}
+	if (tr.acc.count == 0) {
+		tr.acc.tstamp = start;
+		tr.acc.min = r.min;
+		tr.acc.max = r.max;
+		tr.csum = tr.vsum = 0.0;
+	}
+	if (r.min < tr.acc.min) tr.acc.min = r.min;
+	if (r.max > tr.acc.max) tr.acc.max = r.max;
+	tr.acc.count += r.count;
+	tr.csum += (double) r.mean * r.count;
+	tr.vsum += (double) r.voltage * r.count;
+}
+
+void CurrentHistory::add(const currentsample &s)
+{
+	if (t.size() == 0) return;
+	historyrecord r;
+	r.tstamp = s.tstamp;
+	r.count = 1;
+	r.min = r.max = r.mean = s.current;
+	r.voltage = s.voltage;
+	r.reserved = 0;
+	push(*t[0], r);
+	accumulate(1, r);
+}
+
+bool CurrentHistory::read(tier &tr, uint64_t n, historyrecord &r)
+{
+	slot &sl = tr.slots[n % tr.n];
+	if (sl.seq.load(std::memory_order_acquire) != n+1) return false;
+	r.tstamp = sl.tstamp.load(std::memory_order_relaxed);
+	r.count = sl.count.load(std::memory_order_relaxed);
+	r.min = sl.min.load(std::memory_order_relaxed);
+	r.max = sl.max.load(std::memory_order_relaxed);
+	r.mean = sl.mean.load(std::memory_order_relaxed);
+	r.voltage = sl.voltage.load(std::memory_order_relaxed);
+	r.reserved = 0;
+	std::atomic_thread_fence(std::memory_order_acquire);
+	return sl.seq.load(std::memory_order_relaxed) == n+1;
+}
+
+unsigned CurrentHistory::tiers()
+{
+	return t.size();
+}
+
+unsigned CurrentHistory::period(unsigned k)
+{
+	if (k >= t.size()) return 0;
+	return t[k]->period / 1000;
+}
+
+unsigned CurrentHistory::size(unsigned k)
+{
+	if (k >= t.size()) return 0;
+	uint64_t h = t[k]->next.load(std::memory_order_acquire);
+	return h < t[k]->n ? h : t[k]->n;
+}
+
+//records overwritten while the query runs are skipped:
+unsigned CurrentHistory::query(unsigned k, uint64_t since, std::function<void(historyrecord &)> f)
+{
+	if (k >= t.size()) return 0;
+	tier &tr = *t[k];
+	historyrecord r;
+	unsigned count = 0;
+	uint64_t h = tr.next.load(std::memory_order_acquire);
+	uint64_t n = h > tr.n ? h - tr.n : 0;
+	for (; n<h; n++) {
+		if (!read(tr, n, r)) continue;
+		if (r.tstamp < since) continue;
+		f(r);
+		count++;
+	}
+	return count;
+}
+
+int CurrentHistory::dump(std::string filename)
+{
+	FILE *f = fopen(filename.c_str(), "wb");
+	if (f == NULL) return -1;
+
+	struct timespec mt, rt;
+	clock_gettime(CLOCK_MONOTONIC, &mt);
+	clock_gettime(CLOCK_REALTIME, &rt);
+	historyheader hh = { HISTORY_MAGIC, HISTORY_VERSION, (uint32_t) t.size(), 0,
+		(uint64_t) mt.tv_sec * 1000000 + mt.tv_nsec / 1000, (uint64_t) rt.tv_sec * 1000000 + rt.tv_nsec / 1000 };
+	fwrite(&hh, sizeof(hh), 1, f);
+
+	//the records are copied out first, so the count in the tier header is exact:
+	int total = 0;
+	std::vector<historyrecord> records;
+	for (unsigned i=0; i<t.size(); i++) {
+		records.clear();
+		query(i, 0, [&records](historyrecord &r) { records.push_back(r); });
+		historytier ht = { t[i]->period, (uint32_t) records.size(), 0 };
+		fwrite(&ht, sizeof(ht), 1, f);
+		if (records.size() > 0) fwrite(records.data(), sizeof(historyrecord), records.size(), f);
+		total += records.size();
+	}
+	if (fclose(f) != 0) return -1;
+	return total;
+}
@@ -0,0 +1,115 @@
+/*
+    This file is part of wavedcc,
+    Copyright (C) 2021 Glenn Butcher.
+
+    wavedcc is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    wavedcc is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with wavedcc.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __CURRENTHISTORY_H__
+#define __CURRENTHISTORY_H__
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+#include <atomic>
+#include <functional>
+
+#include "samplering.h"
+
+#define HISTORY_MAGIC 0x48434457  //"WDCH"
+#define HISTORY_VERSION 1
+
+//One history record, a raw sample or the aggregate of the samples in a period.  A raw sample
+//has count 1 and min, max and mean all its current:
+struct historyrecord {
+	uint64_t tstamp;	//microseconds, CLOCK_MONOTONIC, the start of the period or the raw sample time
+	uint32_t count;		//samples aggregated
+	float min, max, mean;	//milliamps
+	float voltage;		//mean voltage, millivolts
+	uint32_t reserved;	//0, pads the record to 32 bytes
+};
+
+//Binary dump layout: a historyheader, then for each tier a historytier followed by its records,
+//oldest first.  monotonic and realtime are the two clocks at the time of the dump, microseconds,
+//to put the record timestamps on the wall clock:
+struct historyheader {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t tiers;
+	uint32_t reserved;
+	uint64_t monotonic;
+	uint64_t realtime;
+};
+
+struct historytier {
+	uint64_t period;	//microseconds per record, 0 for the raw samples
+	uint32_t records;	//records that follow
+	uint32_t reserved;
+};
+
+//Round-robin current/voltage history in fixed memory.  Tier 0 holds the raw samples; each tier
+//after it holds the aggregates of fixed periods, fed by the records the tier before it completes, 
+//so each sample costs one record in tier 0 and an accumulator update in tier 1, and the rest only
+//at the period boundaries.  There is one writer, runDCCCurrent(); readers copy records out with
+//the same per-slot sequence check as SampleRing, so they never block the writer.
+class CurrentHistory
+{
+public:
+	CurrentHistory();
+	~CurrentHistory();
+
+	//adds a tier of size records of period milliseconds, 0 for the raw samples; tiers are to be
+	//added raw first, in increasing period, before the first add():
+	void addTier(unsigned period, unsigned size);
+
+	void add(const currentsample &s);
+
+	unsigned tiers();
+	unsigned period(unsigned tier);	//milliseconds
+	unsigned size(unsigned tier);	//records held
+
+	//passes the records of tier from since, a CLOCK_MONOTONIC timestamp, on to f, oldest first.
+	//Returns the number of records passed:
+	unsigned query(unsigned tier, uint64_t since, std::function<void(historyrecord &)> f);
+
+	//writes all the tiers to filename in the binary dump layout, returns the records written, 
+	//or -1 if the file can't be written:
+	int dump(std::string filename);
+
+private:
+	struct slot {
+		std::atomic<uint64_t> seq;  //record number + 1 of the record in the slot, 0 while it's being written
+		std::atomic<uint64_t> tstamp;
+		std::atomic<uint32_t> count;
+		std::atomic<float> min, max, mean, voltage;
+	};
+
+	struct tier {
+		uint64_t period;	//microseconds
+		unsigned n;
+		slot *slots;
+		std::atomic<uint64_t> next;
+		historyrecord acc;	//the writer's accumulator for the period in progress
+		double csum, vsum;
+	};
+
+	void push(tier &t, const historyrecord &r);
+	void accumulate(unsigned k, const historyrecord &r);
+	bool read(tier &t, uint64_t n, historyrecord &r);
+
+	std::vector<tier *> t;
+};
+
+#endif
@@ -0,0 +1,60 @@
+/*
+    This file is part of wavedcc,
+    Copyright (C) 2021 Glenn Butcher.
+
+    wavedcc is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    wavedcc is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with wavedcc.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __CURRENTSENSOR_H__
+#define __CURRENTSENSOR_H__
+
+#include <string>
+
+//Current sensor interface, implemented by the I2C sensors, INA219 (ina219.h), INA260 (ina260.h)
+//and ADS1115 (ads1115.h), and by SimulatedSensor (simsensor.h).  The sensor is selected with the 
+//'sensor' property in wavedcc.conf.  Currents are milliamps, voltages millivolts.
+class CurrentSensor
+{
+public:
+	virtual ~CurrentSensor() { }
+
+	virtual float get_current() = 0;
+	virtual float get_voltage() = 0;
+
+	//returns false if there's no new reading since the last call; a sensor without a
+	//conversion-ready indication always has one:
+	virtual bool get_current_ready(float &current, float &voltage)
+	{
+		voltage = get_voltage();
+		current = get_current();
+		return true;
+	}
+
+	//sets the averaging of the current and voltage readings, for the sensors that have it; call
+	//before configuring the sensor:
+	virtual void set_averaging(int current, int voltage) { }
+
+	//microseconds between new readings, 0 if not known:
+	virtual int conversion_micros() { return 0; }
+
+	//sets the sensor's alert output to assert above ma milliamps, for the alertpin overload trip;
+	//returns false for a sensor without one:
+	virtual bool set_alert(float ma) { return false; }
+
+	virtual int deconfigure() { return 0; }
+
+	virtual std::string name() = 0;
+};
+
+#endif
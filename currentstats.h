@@ -0,0 +1,131 @@
+/*
+    This file is part of wavedcc,
+    Copyright (C) 2021 Glenn Butcher.
+
+    wavedcc is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    wavedcc is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with wavedcc.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __CURRENTSTATS_H__
+#define __CURRENTSTATS_H__
+
+#include <stdint.h>
+#include <math.h>
+#include <atomic>
+
+#include "samplering.h"
+
+struct windowstats {
+	uint64_t tstamp;	//microseconds, CLOCK_MONOTONIC, the last sample of the window
+	unsigned count;		//samples in the window, 0 until the first window is complete
+	float min, max, mean, rms;	//milliamps
+};
+
+//Current statistics over successive windows of a fixed length, accumulated sample by sample by
+//runDCCCurrent, so the cost is the same few operations per sample regardless of the window.  When
+//a sample falls past the end of the window, the window's statistics are published and the next
+//one starts with that sample.  The publication is a seqlock, like SampleSnapshot's: the writer
+//never waits, and a reader gets the statistics of one whole window.
+class WindowStats
+{
+public:
+	explicit WindowStats(unsigned ms)
+	{
+		length = (uint64_t) ms * 1000;
+		start = 0;
+		reset();
+		seq = 0;
+		tstamp = 0;
+		count = 0;
+		min = max = mean = rms = 0.0;
+	}
+
+	//window length, milliseconds:
+	unsigned window()
+	{
+		return length / 1000;
+	}
+
+	void add(const currentsample &s)
+	{
+		if (start == 0) start = s.tstamp;
+		if (s.tstamp - start >= length) {
+			if (n > 0) publish();
+			reset();
+			start = s.tstamp;
+		}
+		n++;
+		sum += s.current;
+		sumsq += (double) s.current * s.current;
+		if (s.current < lo) lo = s.current;
+		if (s.current > hi) hi = s.current;
+		last = s.tstamp;
+	}
+
+	//the statistics of the last complete window:
+	windowstats load()
+	{
+		windowstats w;
+		uint64_t q1, q2;
+		do {
+			q1 = seq.load(std::memory_order_acquire);
+			w.tstamp = tstamp.load(std::memory_order_relaxed);
+			w.count = count.load(std::memory_order_relaxed);
+			w.min = min.load(std::memory_order_relaxed);
+			w.max = max.load(std::memory_order_relaxed);
+			w.mean = mean.load(std::memory_order_relaxed);
+			w.rms = rms.load(std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_acquire);
+			q2 = seq.load(std::memory_order_relaxed);
+		} while ((q1 & 1) | (q1 != q2));
+		return w;
+	}
+
+private:
+	void reset()
+	{
+		n = 0;
+		sum = sumsq = 0.0;
+		lo = INFINITY;
+		hi = -INFINITY;
+		last = 0;
+	}
+
+	void publish()
+	{
+		uint64_t q = seq.load(std::memory_order_relaxed);
+		seq.store(q+1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+		tstamp.store(last, std::memory_order_relaxed);
+		count.store(n, std::memory_order_relaxed);
+		min.store(lo, std::memory_order_relaxed);
+		max.store(hi, std::memory_order_relaxed);
+		mean.store(sum / n, std::memory_order_relaxed);
+		rms.store(sqrt(sumsq / n), std::memory_order_relaxed);
+		seq.store(q+2, std::memory_order_release);
+	}
+
+	//the writer's accumulators for the window in progress:
+	uint64_t length, start, last;
+	unsigned n;
+	double sum, sumsq;
+	float lo, hi;
+
+	//the last complete window:
+	std::atomic<uint64_t> seq;
+	std::atomic<uint64_t> tstamp;
+	std::atomic<unsigned> count;
+	std::atomic<float> min, max, mean, rms;
+};
+
+#endif
@@ -0,0 +1,186 @@
+/*
+    This file is part of wavedcc,
+    Copyright (C) 2021 Glenn Butcher.
+
+    wavedcc is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    wavedcc is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with wavedcc.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <sstream>
+
+#include "cvcache.h"
+
+#define BIT(map, cv) ((map[(cv)/8] >> ((cv)%8)) & 1)
+#define SETBIT(map, cv) (map[(cv)/8] |= 1 << ((cv)%8))
+#define CLEARBIT(map, cv) (map[(cv)/8] &= ~(1 << ((cv)%8)))
+
+CVCache::CVCache()
+{
+	header = NULL;
+	records = NULL;
+	length = 0;
+	fd = -1;
+}
+
+CVCache::~CVCache()
+{
+	close();
+}
+
+bool CVCache::open(std::string filename)
+{
+	struct stat st;
+	length = sizeof(cvcacheheader) + CVCACHE_DECODERS * sizeof(cvrecord);
+
+	fd = ::open(filename.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+	if (fd < 0) return false;
+	if (fstat(fd, &st) < 0) { close(); return false; }
+	if ((size_t) st.st_size != length) {
+		if (ftruncate(fd, length) < 0) { close(); return false; }
+	}
+
+	void *m = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (m == MAP_FAILED) { close(); return false; }
+	header = (cvcacheheader *) m;
+	records = (cvrecord *) ((char *) m + sizeof(cvcacheheader));
+
+	//a new file, or one of a different layout, is started over:
+	if ((header->magic != CVCACHE_MAGIC) | (header->version != CVCACHE_VERSION) |
+	    (header->decoders != CVCACHE_DECODERS) | (header->cvs != CVCACHE_CVS)) {
+		memset(m, 0, length);
+		header->magic = CVCACHE_MAGIC;
+		header->version = CVCACHE_VERSION;
+		header->decoders = CVCACHE_DECODERS;
+		header->cvs = CVCACHE_CVS;
+	}
+	return true;
+}
+
+void CVCache::close()
+{
+	if (header) {
+		msync(header, length, MS_SYNC);
+		munmap(header, length);
+	}
+	if (fd >= 0) ::close(fd);
+	header = NULL;
+	records = NULL;
+	fd = -1;
+}
+
+bool CVCache::isopen()
+{
+	return header != NULL;
+}
+
+int CVCache::find(unsigned address, int version, int manufacturer)
+{
+	int found = -1;
+	if (!records) return -1;
+	for (int i=0; i<CVCACHE_DECODERS; i++) {
+		cvrecord &r = records[i];
+		if ((r.address == 0) | (r.address != address)) continue;
+		if ((version >= 0) & (r.version != version)) continue;
+		if ((manufacturer >= 0) & (r.manufacturer != manufacturer)) continue;
+		if ((found < 0) || (r.updated > records[found].updated)) found = i;
+	}
+	return found;
+}
+
+int CVCache::add(unsigned address, unsigned version, unsigned manufacturer)
+{
+	if (!records) return -1;
+	int slot = 0;
+	for (int i=0; i<CVCACHE_DECODERS; i++) {
+		if (records[i].address == 0) { slot = i; break; }
+		if (records[i].updated < records[slot].updated) slot = i;
+	}
+	memset(&records[slot], 0, sizeof(cvrecord));
+	identify(slot, address, version, manufacturer);
+	return slot;
+}
+
+void CVCache::identify(int record, unsigned address, unsigned version, unsigned manufacturer)
+{
+	if ((!records) | (record < 0)) return;
+	records[record].address = address;
+	records[record].version = version;
+	records[record].manufacturer = manufacturer;
+	records[record].updated = time(NULL);
+}
+
+//CVs are numbered from 1, stored from 0:
+int CVCache::get(int record, unsigned cv)
+{
+	if ((!records) | (record < 0) | (cv < 1) | (cv > CVCACHE_CVS)) return -1;
+	cv--;
+	if (!BIT(records[record].known, cv)) return -1;
+	return records[record].value[cv];
+}
+
+void CVCache::set(int record, unsigned cv, unsigned char value)
+{
+	if ((!records) | (record < 0) | (cv < 1) | (cv > CVCACHE_CVS)) return;
+	cv--;
+	cvrecord &r = records[record];
+	if (!BIT(r.known, cv)) {
+		SETBIT(r.known, cv);
+		r.original[cv] = value;
+	}
+	else if (r.value[cv] != value) {
+		r.changes++;
+	}
+	r.value[cv] = value;
+	if (value != r.original[cv]) SETBIT(r.changed, cv); else CLEARBIT(r.changed, cv);
+	r.updated = time(NULL);
+}
+
+std::string CVCache::list()
+{
+	std::stringstream l;
+	if (!records) return "<Error: no CV cache.>";
+	for (int i=0; i<CVCACHE_DECODERS; i++) {
+		cvrecord &r = records[i];
+		if (r.address == 0) continue;
+		int known = 0, changed = 0;
+		for (unsigned cv=0; cv<CVCACHE_CVS; cv++) {
+			known += BIT(r.known, cv);
+			changed += BIT(r.changed, cv);
+		}
+		l << "<cvc " << r.address << " " << (int) r.version << " " << (int) r.manufacturer
+		  << " known=" << known << " changed=" << changed << " changes=" << r.changes << ">\n";
+	}
+	return l.str();
+}
+
+std::string CVCache::show(int record)
+{
+	std::stringstream l;
+	if ((!records) | (record < 0)) return "<Error: no such decoder.>";
+	cvrecord &r = records[record];
+	l << "<cvc " << r.address << " " << (int) r.version << " " << (int) r.manufacturer;
+	for (unsigned cv=0; cv<CVCACHE_CVS; cv++) {
+		if (!BIT(r.known, cv)) continue;
+		l << " " << cv+1 << "=" << (int) r.value[cv];
+		if (BIT(r.changed, cv)) l << "(" << (int) r.original[cv] << ")";
+	}
+	l << ">";
+	return l.str();
+}
@@ -0,0 +1,84 @@
+/*
+    This file is part of wavedcc,
+    Copyright (C) 2021 Glenn Butcher.
+
+    wavedcc is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    wavedcc is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with wavedcc.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __CVCACHE_H__
+#define __CVCACHE_H__
+
+#include <stdint.h>
+
+#include <string>
+
+#define CVCACHE_MAGIC 0x56434457  //"WDCV"
+#define CVCACHE_VERSION 1
+#define CVCACHE_DECODERS 64
+#define CVCACHE_CVS 1024
+
+//One decoder's CVs, identified by its active address and CV7/CV8.  original holds the first value
+//seen for each CV, and the changed bitmap marks the CVs whose value has since changed from it.
+struct cvrecord {
+	uint16_t address;	//active address, 0 if the record is unused
+	uint8_t version;	//CV7
+	uint8_t manufacturer;	//CV8
+	uint32_t updated;	//time of the last update, seconds since the epoch
+	uint32_t changes;	//count of updates that changed a known value
+	uint8_t known[CVCACHE_CVS/8];
+	uint8_t changed[CVCACHE_CVS/8];
+	uint8_t value[CVCACHE_CVS];
+	uint8_t original[CVCACHE_CVS];
+};
+
+struct cvcacheheader {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t decoders;
+	uint32_t cvs;
+};
+
+//Persistent CV store, a fixed-size file of CVCACHE_DECODERS records memory-mapped at open(), so
+//loading it is just the mmap, and updates go to the file without explicit writes.  Records are
+//referred to by index; when the file is full, the least recently updated record is reused.
+class CVCache
+{
+public:
+	CVCache();
+	~CVCache();
+
+	bool open(std::string filename);
+	void close();
+	bool isopen();
+
+	//index of the record for address and CV7/CV8, or -1; a version or manufacturer of -1
+	//matches any, in which case the most recently updated match is returned:
+	int find(unsigned address, int version=-1, int manufacturer=-1);
+	int add(unsigned address, unsigned version, unsigned manufacturer);
+	void identify(int record, unsigned address, unsigned version, unsigned manufacturer);
+
+	int get(int record, unsigned cv);  //value, or -1 if not known
+	void set(int record, unsigned cv, unsigned char value);
+
+	std::string list();	//one line per decoder
+	std::string show(int record);	//known CVs of the decoder, changed ones marked with their original value
+
+private:
+	cvcacheheader *header;
+	cvrecord *records;
+	size_t length;
+	int fd;
+};
+
+#endif
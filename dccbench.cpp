@@ -0,0 +1,118 @@
+/*
+    This file is part of wavedcc,
+    Copyright (C) 2021 Glenn Butcher.
+
+    wavedcc is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    wavedcc is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with wavedcc.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+//Command throughput benchmark: replays a file of DCC++ commands through dccCommand(), through
+//both the std::string and the caller's buffer interfaces, and reports the commands per second.
+//The commands are taken from the file as <...> frames, so a raw capture of a JMRI connection works
+//as well as one command per line; lines starting with '#' are comments.  jmri-sample.replay is a
+//synthetic example of the command mix.
+//
+//usage: dccbench [-n passes] [-p] replayfile
+//	-n: passes over the replay, default 10
+//	-p: turns MAIN on for the run, so the throttle commands queue packets; otherwise they're 
+//	    answered with the not-running error, which still exercises the parsing.  Only on a bench
+//	    track: every queued packet is sent.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "dccengine.h"
+
+uint64_t now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec*(uint64_t)1000000+ts.tv_nsec/1000;
+}
+
+int main (int argc, char **argv)
+{
+	int passes = 10;
+	bool power = false;
+	int opt;
+	while ((opt = getopt(argc, argv, "n:p")) != -1) {
+		switch (opt) {
+			case 'n':
+				passes = atoi(optarg);
+				break;
+			case 'p':
+				power = true;
+				break;
+		}
+	}
+	if (optind >= argc) {
+		std::cout << "usage: dccbench [-n passes] [-p] replayfile" << std::endl;
+		exit(1);
+	}
+
+	std::vector<std::string> commands;
+	std::ifstream infile(argv[optind]);
+	std::string line;
+	while (std::getline(infile, line)) {
+		if (line[0] == '#') continue;
+		size_t start = 0, end;
+		while ((start = line.find('<', start)) != std::string::npos) {
+			if ((end = line.find('>', start)) == std::string::npos) break;
+			commands.push_back(line.substr(start, end - start + 1));
+			start = end + 1;
+		}
+	}
+	infile.close();
+	if (commands.size() == 0) {
+		std::cout << "No commands in " << argv[optind] << std::endl;
+		exit(1);
+	}
+
+	std::string initresult = dccInit();
+	if (initresult.find("Error") != std::string::npos) {
+		std::cout << initresult << std::endl;
+		exit(1);
+	}
+	if (power) std::cout << dccCommand("<1 MAIN>") << std::endl;
+
+	uint64_t n = (uint64_t) passes * commands.size();
+	size_t bytes = 0;
+
+	uint64_t t1 = now();
+	for (int p=0; p<passes; p++) 
+		for (unsigned i=0; i<commands.size(); i++) 
+			bytes += dccCommand(commands[i]).size();
+	uint64_t t2 = now();
+
+	char response[4096];
+	for (int p=0; p<passes; p++) 
+		for (unsigned i=0; i<commands.size(); i++) 
+			bytes += dccCommand(commands[i].data(), commands[i].size(), response, sizeof(response));
+	uint64_t t3 = now();
+
+	if (power) std::cout << dccCommand("<0>") << std::endl;
+
+	printf("%lu commands, %d passes of %s\n", (unsigned long) n, passes, argv[optind]);
+	printf("string interface: %.0f commands/s, %.2fus/command\n", n * 1e6 / (t2 - t1), (double) (t2 - t1) / n);
+	printf("buffer interface: %.0f commands/s, %.2fus/command\n", n * 1e6 / (t3 - t2), (double) (t3 - t2) / n);
+
+	dccFinish();
+	exit(0);
+}
@@ -0,0 +1,60 @@
+/*
+    This file is part of wavedcc,
+    Copyright (C) 2021 Glenn Butcher.
+
+    wavedcc is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    wavedcc is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with wavedcc.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __DCCBINARY_H__
+#define __DCCBINARY_H__
+
+#include <stdint.h>
+#include <arpa/inet.h>
+
+#include "dcclocal.h"
+
+//Binary protocol for clients that drive many locomotives at once, on wavedccd's binary TCP port
+//(-b port).  Each frame is a 16-bit length, the bytes that follow it, then a dccbinaryheader and
+//its records; all fields are in network byte order.  A DCCBINARY_COMMANDS frame of dcclococommands,
+//per dcclocal.h, is answered by a DCCBINARY_STATUS frame with the same tag and a dcclocostatus 
+//per command, in order; a command with no flags and no fmask just reports the locomotive's 
+//state.  A frame that can't be read is answered by a DCCBINARY_ERROR frame with no records.
+#define DCCBINARY_COMMANDS 1
+#define DCCBINARY_STATUS 2
+#define DCCBINARY_ERROR 255
+
+#define DCCBINARY_MAXFRAME 65535
+
+struct dccbinaryheader {
+	uint8_t op;
+	uint8_t reserved;
+	uint16_t tag;		//the client's, repeated in the reply
+};
+
+//between host and network byte order, either way:
+inline void dccbinarySwap(dcclococommand &c)
+{
+	c.address = htons(c.address);
+	c.functions = htonl(c.functions);
+	c.fmask = htonl(c.fmask);
+}
+
+inline void dccbinarySwap(dcclocostatus &s)
+{
+	s.address = htons(s.address);
+	s.functions = htonl(s.functions);
+	s.result = htonl(s.result);
+}
+
+#endif
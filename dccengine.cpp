@@ -25,12 +25,16 @@
 //#include "pigpio_errors.h"
 
 #include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <math.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <signal.h>
 #include <time.h>
 #include <unistd.h>
 #include <sys/time.h>
+#include <sys/timerfd.h>
 
 #include <string>
 #include <iostream> 
@@ -41,11 +45,24 @@
 #include <deque>
 #include <thread>
 #include <mutex>
+#include <atomic>
 #include <algorithm>
+#include <functional>
 
 #include "dccpacket.h"
 #include "DatagramSocket.h"
 #include "ina219.h"
+#include "ina260.h"
+#include "ads1115.h"
+#include "simsensor.h"
+#include "samplering.h"
+#include "currentstats.h"
+#include "currenthistory.h"
+#include "ackdetector.h"
+#include "protection.h"
+#include "cvcache.h"
+#include "dcctokens.h"
+#include "dccengine.h"
 
 #define MILLISEC_INTERVAL 500.0 //.01 second interval between voltage/current updates; this is in addition to the apx 1.4ms needed to read voltage,current
 
@@ -62,10 +79,11 @@ long timestamp()
 }
 */
 
+//microseconds, monotonic so intervals computed from current samples aren't disturbed by clock changes:
 uint64_t timestamp() {
-    struct timeval tv;
-    gettimeofday(&tv,NULL);
-    return tv.tv_sec*(uint64_t)1000000+tv.tv_usec;
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec*(uint64_t)1000000+ts.tv_nsec/1000;
 }
 
 void loginit()
@@ -111,14 +129,52 @@ void set_thread_name(std::thread* thread, const char* threadName)
 }
 
 
+//Packets from the commands, for runDCC() to send ahead of the roster refresh.  The queue holds
+//at most max packets, so a flood of commands can't stretch the latency of all the ones after
+//it; addCommand() refuses the packets past that, and counts them.
 class CommandQueue
 {
 public:
-	void addCommand(DCCPacket p)
+	CommandQueue()
 	{
+		max = 64;
+		added = refused = deferred = highwater = 0;
+	}
+
+	void setMax(unsigned n)
+	{
+		max = n;
+	}
+
+	//adds repeat copies of p, all or none:
+	bool addCommand(DCCPacket p, unsigned repeat=1)
+	{
+		m.lock();
+		if (cq.size() + repeat > max) {
+			refused++;
+			m.unlock();
+			return false;
+		}
+		for (unsigned i=0; i<repeat; i++) cq.push_front(p);
+		added += repeat;
+		if (cq.size() > highwater) highwater = cq.size();
+		m.unlock();
+		return true;
+	}
+
+	//counts a refused speed packet left to the roster refresh:
+	void defer()
+	{
+		deferred++;
+	}
+
+	std::string status()
+	{
+		std::stringstream s;
 		m.lock();
-		cq.push_front(p);
+		s << "<qs " << cq.size() << " " << max << " " << added << " " << refused << " " << deferred << " " << highwater << ">";
 		m.unlock();
+		return s.str();
 	}
 	
 	DCCPacket getCommand()
@@ -139,6 +195,9 @@ public:
 private:
 	std::deque<DCCPacket> cq;
 	std::mutex m; 
+	unsigned max;
+	uint64_t added, refused, deferred;
+	unsigned highwater;
 };
 
 
@@ -151,6 +210,7 @@ struct roster_item {
 	unsigned fgroup1, fgroup2, fgroup3;
 	long tstamp;	// uptime calculation
 	int uptime;	// uptime accumulator
+	bool estop;	// stopped by an emergency stop, speed 0
 };
 
 class Roster
@@ -166,10 +226,27 @@ public:
 	
 	roster_item get(unsigned address)
 	{
+		roster_item r;
+		m.lock();
 		if (rr.find(address) == rr.end()) rr[address] = roster_item{ address, 0, 0, 0, 128, 176, 160, 0, 0}; 
-		return rr[address];
+		r = rr[address];
+		m.unlock();
+		return r;
 	}
 	
+	//like get(), but doesn't add an address that isn't there:
+	bool find(unsigned address, roster_item &r)
+	{
+		bool found = false;
+		m.lock();
+		if (rr.find(address) != rr.end()) {
+			r = rr[address];
+			found = true;
+		}
+		m.unlock();
+		return found;
+	}
+
 	void set(unsigned address, roster_item r)
 	{
 		m.lock();
@@ -186,7 +263,7 @@ public:
 		m.unlock();
 	}
 	
-	void update(unsigned address, unsigned speed, unsigned direction, unsigned headlight)
+	void update(unsigned address, unsigned speed, unsigned direction, unsigned headlight, bool estop=false)
 	{
 		long tstamp = timestamp();
 		m.lock();
@@ -204,14 +281,19 @@ public:
 		rr[address].speed = speed;
 		rr[address].direction = direction;
 		rr[address].headlight = headlight;
+		rr[address].estop = estop;
 		m.unlock();
 	}
 	
 	roster_item getNext()
 	{
-		if (rr.size() == 0) return roster_item{ 0, 0, 0, 0, 128, 176, 160}; 
 		roster_item i;
 		m.lock();
+		if (rr.size() == 0) {
+			m.unlock();
+			return roster_item{ 0, 0, 0, 0, 128, 176, 160}; 
+		}
+		if (next == rr.end()) next = rr.begin();  //the first insert leaves next at end
 		i = next->second;
 		if (++next == rr.end()) next = rr.begin();
 		m.unlock();
@@ -222,8 +304,9 @@ public:
 	{
 		int result;
 		m.lock();
+		if ((next != rr.end()) && (next->first == address)) ++next;  //erase invalidates it
 		result = rr.erase(address);
-		if (++next == rr.end()) next = rr.begin();
+		if (next == rr.end()) next = rr.begin();
 		m.unlock();
 		if (result == 1) return true;
 		return false;
@@ -240,23 +323,27 @@ public:
 	std::string list()
 	{
 		std::stringstream l;
+		m.lock();
 		l << "roster: " << std::endl;
 		for (std::map<unsigned, roster_item>::iterator it = rr.begin(); it != rr.end(); ++it)
 			l << it->first << ": " << (it->second).speed << " " << (it->second).direction << std::endl;
 		if (rr.size() == 0)
 			l <<  "No entries." << std::endl;
+		m.unlock();
 		return l.str();
 	}
 	
 	std::string uptimes()
 	{
 		std::stringstream l;
+		m.lock();
 		l << "uptimes (sec): " << std::endl;
 		for (std::map<unsigned, roster_item>::iterator it = rr.begin(); it != rr.end(); ++it)
 			//l << it->first << ": " << (it->second).uptime << std::endl;
 			l << it->first << ":" << ((it->second).uptime / 1000000) << std::endl;
 		if (rr.size() == 0)
 			l <<  "No entries." << std::endl;
+		m.unlock();
 		return l.str();
 	}
 	
@@ -264,10 +351,12 @@ public:
 	{
 		std::ofstream uptimefile;
 		uptimefile.open(filename);
+		m.lock();
 		for (std::map<unsigned, roster_item>::iterator it = rr.begin(); it != rr.end(); ++it) {
 			uptimefile << it->first << ":" << ((it->second).uptime / 1000000) << std::endl;
 			it->second.uptime = 0;
 		}
+		m.unlock();
 		uptimefile.close();
 	}
 
@@ -331,8 +420,8 @@ CommandQueue commandqueue;
 //global declaration of the roster used to refresh speed/dir packets
 Roster roster;
 
-//flag to control runDCC()
-bool running = false;
+//flag to control runDCC(), read by the throttle commands on the caller's thread:
+std::atomic<bool> running(false);
 
 //flag to control runDCCCurrent()
 bool currenting = false;
@@ -340,31 +429,117 @@ bool currenting = false;
 //flag to control programming:
 bool programming = false;
 
-//flag to control speed step mode:
-bool steps28 = true;
+//flag to control speed step mode, set by <D SPEED28|SPEED128> on the worker, read by the throttle
+//commands on the caller's thread:
+std::atomic<bool> steps28(true);
 
-//current and voltage variables, populated by runDCCCurrent:
-float voltage;
-float current;
+//latest current and voltage, published by runDCCCurrent; latest.load() never blocks:
+SampleSnapshot latest;
 
-//millisecond value to sleep the runDCCCurrent thread:
-float millisec;
+//millisecond interval between runDCCCurrent samples:
+std::atomic<float> millisec;
 
-std::mutex vc;  //use this to guard voltage/current/highwater access
-INA219 ina; //The class for interface with the INA219 through I2C
+//runDCCCurrent sampling intervals, milliseconds, with power applied to a track and idle.  Changeable
+//with the 'sampleinterval' and 'idleinterval' properties in wavedcc.conf, no shorter than 
+//INTERVAL_MIN; a zero interval would disarm the timer, and stop the sampling altogether:
+#define INTERVAL_MIN 0.1
+float sample_interval = 2.0;
+float idle_interval = MILLISEC_INTERVAL;
+
+//reads an interval property into interval, leaving it alone if the value isn't a positive
+//number, and raising it to INTERVAL_MIN if it's shorter:
+void intervalProperty(std::map<std::string, std::string> &config, std::string name, float &interval)
+{
+	if (config.find(name) == config.end()) return;
+	float ms = atof(config[name].c_str());
+	if (!(ms > 0.0)) {
+		std::cout << "Malformed " << name << ", ignored." << std::endl;
+		return;
+	}
+	if (ms < INTERVAL_MIN) {
+		std::cout << name << " " << ms << "ms is too short, using " << INTERVAL_MIN << "ms." << std::endl;
+		ms = INTERVAL_MIN;
+	}
+	interval = ms;
+}
+
+//timestamped current samples, published by runDCCCurrent for the ack detection:
+SampleRing<1024> samplering;
+
+//current statistics over windows of the lengths in milliseconds listed in the 'statwindows' 
+//property in wavedcc.conf, updated by runDCCCurrent, shortest first:
+std::vector<WindowStats *> currentwindows;
+
+//current/voltage history, the raw samples and their aggregates over increasing periods, fed by
+//runDCCCurrent.  Sized by the 'historysamples' and 'historytiers' properties in wavedcc.conf; 
+//dumped by the <hd> command to files in historypath, set by the property 'historypath':
+CurrentHistory history;
+std::string historypath = "./";
+
+//timerfd that paces runDCCCurrent:
+int currentfd = -1;
+
+//The current sensor, selected by the 'sensor' property in wavedcc.conf, at the I2C address set
+//by 'sensoraddress'; see makeSensor():
+CurrentSensor *sensor = NULL;
+std::string sensor_type = "ina219";
+int sensor_address = 0x40;
+
+//Sensor ADC averaging, samples per conversion for the current and the voltage, and whether to 
+//publish only completed conversions.  Set by the 'inaaverage', 'inabusaverage' and 'inaready' 
+//properties in wavedcc.conf:
+int ina_average = 32;
+int ina_busaverage = 32;
+bool ina_ready = false;
+
+//kernel I2C device for the current sensors, e.g., /dev/i2c-1, set by the property 'i2cdevice'; 
+//if empty, the sensors are read through pigpio:
+std::string i2c_device = "";
 
 //GPIO ports to use for DCC output, set in the first part of main()
 int MAIN1, MAIN2, MAINENABLE;
 int PROG1, PROG2, PROGENABLE;
 
+//Programming tracks for parallel service mode.  Track 0 is PROG1/PROG2/PROGENABLE, sensed by 
+//sensor and published to samplering; up to PROGTRACKS_MAX-1 more are added with the 'progtrackN' 
+//properties in wavedcc.conf, each with its own current sensor at a different I2C address.  The
+//tracks past 0 are sampled by threads of their own, runProgTrackCurrent, so their sensors' I2C
+//reads don't add to runDCCCurrent's tick:
+#define PROGTRACKS_MAX 4
+struct progtrack {
+	int pin1, pin2, enable;
+	int i2caddress;
+	CurrentSensor *sensor;
+	SampleRing<1024> *ring;
+	OverloadCounter overloads;
+	int timerfd = -1;		//paces the track's sampler, at runDCCCurrent's interval
+	std::thread *sampler = NULL;
+};
+std::vector<progtrack> progtracks;
+
+//set while a parallel session has the programming tracks powered, for the tracks past 0 to be
+//sampled:
+std::atomic<bool> progparallel(false);
+
 //variables to control CV reading behavior:
 int sample_count = 10; //number of samples from the tail of the current measurment vector to use in determining quiescent current
 float ack_limit = 60.0; //milliamps over quiescent to determine an ack, per S-9.2.3 60ma. Changeable with 'acklimit' property in wavedcc.conf
-int ack_min = 5; // number of current measurements > quiescent + ack_limit to count in determining an ack, per S-9.2.5, 6ms +/- 1ms, so count >=5.  Changeable with 'ackmin' property in wavedcc.conf
-
-//overload threshold in milliamps:
-float overload_threshold = 3000.0;
-bool overload_trip = false;
+int ack_min = 5; // milliseconds of current samples > quiescent + ack_limit to count in determining an ack, per S-9.2.5, 6ms +/- 1ms, so >=5.  Changeable with 'ackmin' property in wavedcc.conf
+float ack_sigma = 3.0; //minimum ack amplitude in standard deviations of the quiescent current noise, for noisy (e.g., sound) decoders.  Changeable with 'acksigma' property in wavedcc.conf
+float ack_confidence = 0.5; //bit verifies with a confidence below this are repeated.  Changeable with 'ackconfidence' property in wavedcc.conf
+int ack_window = 20; //milliseconds after the last packet of a verify chain to wait for an ack to start before stopping the chain.  Changeable with 'ackwindow' property in wavedcc.conf
+float drift_limit = 20.0; //milliamps of baseline change in a programming session before quiescent is recalibrated.  Changeable with 'driftlimit' property in wavedcc.conf
+
+//Overload protection (protection.h).  A trip, by runDCCCurrent or by the sensor's alert pin, turns
+//the track enables off without stopping the pulse train, and runDCCCurrent restores power once the
+//backoff has passed; a lockout holds power off until the next <1>.  The threshold in milliamps and
+//the consecutive samples over it that trip, the backoff, backoff maximum and clear milliseconds 
+//and the retries are set by the 'overloadthreshold', 'overloadsamples', 'overloadbackoff', 
+//'overloadbackoffmax', 'overloadclear' and 'overloadretries' properties in wavedcc.conf, the alert
+//pin by 'alertpin':
+protectparams protect_params = { 3000.0, 3, 500, 8000, 2000, 3 };
+Protection protection(protect_params);
+int alert_pin = -1;
 
 //for runDCC() engine and runDCCCurrent() current monitoring threads:
 std::thread *t = NULL;
@@ -376,64 +551,206 @@ std::string uptimefilepath = "./";
 //boolean to be set by the property 'uptimelogging':
 bool uptimelogging = false;
 
+//directory of the CV profiles used to predict values for speculative reads, set by the property 'cvprofilepath':
+std::string cvprofilepath = "./";
+
+//maximum number of predicted values to verify before walking the bits of a CV, set by the property 'speculate':
+unsigned speculate_max = 2;
+
+//persistent per-decoder CV store, file set by the property 'cvcachefile':
+CVCache cvcache;
+std::string cvcachefile = "./wavedcc.cvcache";
+
 #ifdef USE_PIGPIOD_IF
 //pigpiod_id hold the identifier returned at initialization, needed by all pigpiod function calls
 int pigpio_id;
 #endif
 
-//Thsi routine is to be run as a thread.  It should be started shortly after initialization and
+//arms the runDCCCurrent timer, and the programming tracks' samplers', at the ms interval.  The
+//change takes effect immediately, even if runDCCCurrent is waiting out a long idle interval.  The
+//timers are never armed with zero, which would disarm them:
+void setCurrentInterval(float ms)
+{
+	if (!(ms >= INTERVAL_MIN)) ms = INTERVAL_MIN;
+	millisec = ms;
+	struct itimerspec its;
+	long us = (long) (ms * 1000);
+	its.it_interval.tv_sec = us / 1000000;
+	its.it_interval.tv_nsec = (us % 1000000) * 1000;
+	its.it_value = its.it_interval;
+	if (currentfd >= 0) timerfd_settime(currentfd, 0, &its, NULL);
+	for (unsigned i=1; i<progtracks.size(); i++) 
+		if (progtracks[i].timerfd >= 0) timerfd_settime(progtracks[i].timerfd, 0, &its, NULL);
+}
+
+//turns the enables of the programming tracks past 0 on or off:
+void progTracksEnable(int level)
+{
+	for (unsigned i=1; i<progtracks.size(); i++) {
+#ifdef USE_PIGPIOD_IF
+		gpio_write(pigpio_id, progtracks[i].enable, level);
+#else
+		gpioWrite(progtracks[i].enable, level);
+#endif
+	}
+}
+
+//turns off all the track enables, the first thing done on a trip:
+void protectDisable()
+{
+#ifdef USE_PIGPIOD_IF
+	gpio_write(pigpio_id, MAINENABLE, 0);
+	gpio_write(pigpio_id, PROGENABLE, 0);
+#else
+	gpioWrite(MAINENABLE, 0);
+	gpioWrite(PROGENABLE, 0);
+#endif
+	progTracksEnable(0);
+}
+
+//arms the protection at power on, or turns it off at power off:
+void protectArm(bool on)
+{
+	protection.arm(on);
+}
+
+//records a trip, called with the enables already off.  latency is the microseconds from the
+//detection of the overload, source and current are for the log, and alert is set for a trip by
+//the alert pin:
+void protectTrip(int latency, std::string source, float current, bool alert=false)
+{
+	char buf[256];
+	if (!protection.trip(timestamp(), latency, alert, protectDisable)) return;  //already tripped, by the other path
+	snprintf(buf, 256, "CURRENT OVERLOAD, %s: %04.2f, disabled in %dus%s", source.c_str(), current, latency, 
+		protection.state() == PROTECT_LOCKOUT ? ", locked out" : "");
+	if (logging) log(buf);
+}
+
+//milliseconds left of the backoff of a trip:
+int protectRemaining()
+{
+	return protection.remaining(timestamp());
+}
+
+//restores power after a trip, once the backoff has passed or, with user set, from a lockout.  The
+//programming track enables are left to the chains, so for them this just rearms the protection:
+void protectRestore(bool user)
+{
+	bool restored = protection.restore(timestamp(), user, []() {
+		if (!running) return;
+#ifdef USE_PIGPIOD_IF
+		gpio_write(pigpio_id, MAINENABLE, 1);
+#else
+		gpioWrite(MAINENABLE, 1);
+#endif
+	});
+	if (restored & logging) log(user ? "overload protection reset" : "overload protection restored power");
+}
+
+//alert pin callback, on the falling edge of the sensor's active-low alert output.  The latency is
+//from the edge to the enables being off, both on the pigpio tick clock:
+#ifdef USE_PIGPIOD_IF
+void protectAlert(int pi, unsigned gpio, unsigned level, uint32_t tick, void *userdata)
+{
+	if ((level != 0) | (protection.state() != PROTECT_ON)) return;
+	protectDisable();
+	int latency = get_current_tick(pigpio_id) - tick;
+#else
+void protectAlert(int gpio, int level, uint32_t tick, void *userdata)
+{
+	if ((level != 0) | (protection.state() != PROTECT_ON)) return;
+	protectDisable();
+	int latency = gpioTick() - tick;
+#endif
+	protectTrip(latency, "alert pin", latest.load().current, true);
+}
+
+//This routine is to be run as a thread, one for each programming track past 0.  It samples the 
+//track's current, paced by the track's timerfd at runDCCCurrent's interval, and publishes it to 
+//the track's ring, with the overload check, while a parallel session has the tracks powered; 
+//otherwise it just waits out the ticks.  With a thread per track, a session with all four tracks
+//doesn't stretch runDCCCurrent's tick with three more I2C reads, and the tracks' reads, on 
+//sensors of their own, go out together rather than one after another:
+void runProgTrackCurrent(unsigned i)
+{
+	progtrack &pt = progtracks[i];
+	uint64_t expirations;
+	currentsample cs;
+	cs.voltage = 0.0;
+
+	while (currenting) {
+		if (read(pt.timerfd, &expirations, sizeof(expirations)) != sizeof(expirations)) continue;
+		if (!progparallel) continue;
+		cs.current = pt.sensor->get_current();
+		cs.tstamp = timestamp();
+		if (pt.overloads.sample(cs.current, cs.tstamp, protect_params) & (protection.state() == PROTECT_ON)) {
+			protectDisable();
+			protectTrip(timestamp() - pt.overloads.detected(), "programming track " + std::to_string(i), cs.current);
+		}
+		pt.ring->push(cs);
+	}
+}
+
+//This routine is to be run as a thread.  It should be started shortly after initialization and
 //left to run for the duration of the execution.  It basically just loops forever, sampling the 
-//voltage and current every 1ms and posting it to global variables.  There is also a "high-water
-//mark" variable, where the maximum current read to-date is posted; this variable can be zeroed
-//out for CV reading/verifying.
+//voltage and current at the millisec interval, paced by a timerfd, posting the readings to latest,
+//and publishing them to samplering, from which the ack detection consumes exact sample windows.
+//Neither blocks, so no reader waits on the I2C transactions.  Overload detection is done here on 
+//every sample, before it's published, and a trip's backoff is timed out here.
+//
+//At the fast sampling interval, only the current register is read, one I2C transaction with the
+//pointer left there; the voltage is updated at the idle interval.  With ina_ready, a sample is
+//published only when the sensor has completed a conversion, so the ring holds no repeats of a 
+//reading when the interval is shorter than the conversion time.  Each published sample is added
+//to the currentwindows statistics and to the history.
 //
 void runDCCCurrent()
 {
 	char buf[256];
-	struct timeval tv1, tv2;
 	int dutycycle;
-	int overload_count = 0;
+	OverloadCounter overloads;
+	uint64_t expirations;
+	currentsample cs;
+	cs.voltage = 0.0;
+
 	while (currenting) {
-		gettimeofday(&tv1, NULL);
-		vc.lock();
-		voltage = ina.get_voltage();
-		current = ina.get_current();
-		vc.unlock();
-		if (!overload_trip) {
-			if (current > overload_threshold) {
-				overload_count++;
-				if (overload_count >=3) {
-#ifdef USE_PIGPIOD_IF
-					gpio_write(pigpio_id, MAINENABLE, 0);
-					gpio_write(pigpio_id, PROGENABLE, 0);
-#else
-					gpioWrite(MAINENABLE, 0);
-					gpioWrite(PROGENABLE, 0);
-#endif
-					overload_trip = true;
-					programming = false;
-					running = false;
-					char m[256];
-					int n = snprintf(m, 256, "CURRENT OVERLOAD: %04.2f", current);
-					if (logging) log(m); 
-				}
-			}
-			else overload_count = 0;
+		if (read(currentfd, &expirations, sizeof(expirations)) != sizeof(expirations)) continue;
+		uint64_t t1 = timestamp();
+		if (ina_ready) {
+			if (!sensor->get_current_ready(cs.current, cs.voltage)) continue; //no new conversion since the last tick
+		}
+		else if (millisec < idle_interval) {
+			cs.current = sensor->get_current();
+		}
+		else {
+			cs.voltage = sensor->get_voltage();
+			cs.current = sensor->get_current();
+		}
+		cs.tstamp = timestamp();
+		if (overloads.sample(cs.current, cs.tstamp, protect_params) & (protection.state() == PROTECT_ON)) {
+			protectDisable();
+			protectTrip(timestamp() - overloads.detected(), progparallel ? "programming track 0" : "track", cs.current);
 		}
+		if (protection.state() == PROTECT_TRIPPED) protectRestore(false);
+		latest.store(cs);
+		samplering.push(cs);
+		for (unsigned i=0; i<currentwindows.size(); i++) currentwindows[i]->add(cs);
+		history.add(cs);
 		//if (logging) logcurrent(current, voltage);
-		gettimeofday(&tv2, NULL);
-		dutycycle = ((tv2.tv_sec - tv1.tv_sec) * 1000000) + (tv2.tv_usec - tv1.tv_usec);
-		snprintf ( buf, 256, "current=%04.2f,voltage=%04.2f,duty_cycle=%dus", current, voltage, dutycycle );
+		dutycycle = cs.tstamp - t1;
+		//expirations > 1 means the sample took longer than the interval, and ticks were missed:
+		snprintf ( buf, 256, "current=%04.2f,voltage=%04.2f,duty_cycle=%dus,missed=%d", cs.current, cs.voltage, dutycycle, (int) expirations - 1 );
 		if (logging) log(buf); 
-		
-		if (millisec > 2) // use the duty cycle to calculate a proper interval
-			usleep((int) ((1000 * millisec) - dutycycle));
-		else	// just sleep the millisec interval above the duty cycle, 
-			//usleep((int) (1000 * millisec));
-			usleep((int) (1000 * 2));
 	}
 } 
 
+//the roster refresh packet for a locomotive, in the speed step mode the throttle commands use:
+DCCPacket refreshPacket(roster_item &i)
+{
+	if (steps28) return DCCPacket::makeBaselineSpeedDirPacket(MAIN1, MAIN2, i.address, i.direction, i.speed, i.headlight);
+	return DCCPacket::makeAdvancedSpeedDirPacket(MAIN1, MAIN2, i.address, i.direction, i.speed, i.headlight);
+}
+
 //uses the example specified at http://abyz.me.uk/rpi/pigpio/cif.html#gpioWaveCreatePad.
 //
 //This routine is to be run as a thread.  It basically starts the DCC pulse train
@@ -474,7 +791,7 @@ void runDCC()
 	else {
 		roster_item i = roster.getNext();
 		if (i.address != 0) 
-			commandPacket = DCCPacket::makeBaselineSpeedDirPacket(MAIN1, MAIN2, i.address, i.direction, i.speed, i.headlight);
+			commandPacket = refreshPacket(i);
 		else
 			commandPacket = idlePacket;
 	}
@@ -510,7 +827,7 @@ void runDCC()
 		else {
 			roster_item i = roster.getNext();
 			if (i.address != 0) 
-				commandPacket = DCCPacket::makeBaselineSpeedDirPacket(MAIN1, MAIN2, i.address, i.direction, i.speed, i.headlight);
+				commandPacket = refreshPacket(i);
 			else
 				commandPacket = idlePacket;
 		}
@@ -534,6 +851,7 @@ void signal_handler(int signum) {
 	gpioWrite(MAINENABLE, 0);
 	gpioWrite(PROGENABLE, 0);
 #endif
+	progTracksEnable(0);
 	if (logging) logclose();
 	logging=false;
 	currenting = false;
@@ -543,12 +861,21 @@ void signal_handler(int signum) {
 		c->~thread();
 		c = NULL;
 	}
+	for (unsigned i=1; i<progtracks.size(); i++) {
+		if (progtracks[i].sampler && progtracks[i].sampler->joinable()) {
+			progtracks[i].sampler->join();
+			progtracks[i].sampler->~thread();
+			progtracks[i].sampler = NULL;
+		}
+	}
 	if (t && t->joinable()) {
 		t->join();
 		t->~thread();
 		t = NULL;
 	}
-	ina.deconfigure();
+	sensor->deconfigure();
+	for (unsigned i=1; i<progtracks.size(); i++) progtracks[i].sensor->deconfigure();
+	cvcache.close();
 #ifdef USE_PIGPIOD_IF
 	pigpio_stop(pigpio_id);
 #else
@@ -558,6 +885,49 @@ void signal_handler(int signum) {
 }
 
 
+//makes and configures a current sensor of type, 'ina219', 'ina260', 'ads1115' or 'sim', the I2C
+//ones at address.  The ADS1115 and simulated sensor settings, and the CVs of the simulated 
+//sensor's decoder, are properties in config:
+CurrentSensor *makeSensor(std::string type, int address, std::map<std::string, std::string> &config)
+{
+	if (type == "sim") {
+		SimulatedSensor *s = new SimulatedSensor(
+			config.find("simquiescent") != config.end() ? atof(config["simquiescent"].c_str()) : 20.0,
+			config.find("simnoise") != config.end() ? atof(config["simnoise"].c_str()) : 2.0,
+			config.find("simack") != config.end() ? atof(config["simack"].c_str()) : 70.0,
+			config.find("simackwidth") != config.end() ? atoi(config["simackwidth"].c_str()) : 6,
+			config.find("simackperiod") != config.end() ? atoi(config["simackperiod"].c_str()) : 0
+		);
+		if (config.find("simtrace") != config.end())
+			if (!s->load(config["simtrace"])) 
+				std::cout << "Trace " << config["simtrace"] << " not loaded, synthesizing the current." << std::endl;
+		if (config.find("simdecoder") != config.end()) s->decoder.configure(config["simdecoder"]);
+		return s;
+	}
+
+	I2CSensor *s;
+	if (type == "ina260") 
+		s = new INA260();
+	else if (type == "ads1115")
+		s = new ADS1115(
+			config.find("adsinput") != config.end() ? config["adsinput"] : "01",
+			config.find("adsfullscale") != config.end() ? atoi(config["adsfullscale"].c_str()) : 2048,
+			config.find("adsmvperamp") != config.end() ? atof(config["adsmvperamp"].c_str()) : 100.0,
+			config.find("adsoffset") != config.end() ? atof(config["adsoffset"].c_str()) : 0.0
+		);
+	else {
+		if (type != "ina219") std::cout << "Unknown sensor " << type << ", using ina219." << std::endl;
+		s = new INA219();
+	}
+	s->set_averaging(ina_average, ina_busaverage);
+#ifdef USE_PIGPIOD_IF
+	s->configure(pigpio_id, i2c_device, address);
+#else
+	s->configure(i2c_device, address);
+#endif
+	return s;
+}
+
 //uptimefilepath
 //uptimelogging
 std::string dccInit()
@@ -609,11 +979,70 @@ std::string dccInit()
 	if (config.find("uptimefilepath") != config.end())
 		uptimefilepath = config["uptimefilepath"];
 
+	if (config.find("cvprofilepath") != config.end()) cvprofilepath = config["cvprofilepath"];
+	if (config.find("cvcachefile") != config.end()) cvcachefile = config["cvcachefile"];
+	if (config.find("speculate") != config.end()) speculate_max = atoi(config["speculate"].c_str());
+
 	if (config.find("samplecount") != config.end()) sample_count = atoi(config["samplecount"].c_str());
 	if (config.find("acklimit") != config.end()) ack_limit = atof(config["acklimit"].c_str());
 	if (config.find("ackmin") != config.end()) ack_min = atoi(config["ackmin"].c_str());
+	if (config.find("acksigma") != config.end()) ack_sigma = atof(config["acksigma"].c_str());
+	if (config.find("ackconfidence") != config.end()) ack_confidence = atof(config["ackconfidence"].c_str());
+	if (config.find("ackwindow") != config.end()) ack_window = atoi(config["ackwindow"].c_str());
+	if (config.find("driftlimit") != config.end()) drift_limit = atof(config["driftlimit"].c_str());
 	
-	if (config.find("overloadthreshold") != config.end()) overload_threshold = atof(config["overloadthreshold"].c_str());
+	intervalProperty(config, "sampleinterval", sample_interval);
+	intervalProperty(config, "idleinterval", idle_interval);
+
+	if (config.find("commandqueuemax") != config.end()) commandqueue.setMax(atoi(config["commandqueuemax"].c_str()));
+
+	if (config.find("overloadthreshold") != config.end()) protect_params.threshold = atof(config["overloadthreshold"].c_str());
+	if (config.find("overloadsamples") != config.end()) protect_params.samples = atoi(config["overloadsamples"].c_str());
+	if (config.find("overloadbackoff") != config.end()) protect_params.backoff = atoi(config["overloadbackoff"].c_str());
+	if (config.find("overloadbackoffmax") != config.end()) protect_params.backoffmax = atoi(config["overloadbackoffmax"].c_str());
+	if (config.find("overloadclear") != config.end()) protect_params.clear = atoi(config["overloadclear"].c_str());
+	if (config.find("overloadretries") != config.end()) protect_params.retries = atoi(config["overloadretries"].c_str());
+	if (config.find("alertpin") != config.end()) alert_pin = atoi(config["alertpin"].c_str());
+
+	if (config.find("inaaverage") != config.end()) ina_average = atoi(config["inaaverage"].c_str());
+	if (config.find("inabusaverage") != config.end()) ina_busaverage = atoi(config["inabusaverage"].c_str());
+	if (config.find("inaready") != config.end()) 
+		if (config["inaready"] == "1")
+			ina_ready = true;
+	if (config.find("i2cdevice") != config.end()) i2c_device = config["i2cdevice"];
+	if (config.find("sensor") != config.end()) sensor_type = config["sensor"];
+	if (config.find("sensoraddress") != config.end()) sensor_address = strtol(config["sensoraddress"].c_str(), NULL, 0);
+
+	std::string statwindows = "100,1000,10000";
+	if (config.find("statwindows") != config.end()) statwindows = config["statwindows"];
+	std::vector<unsigned> windows;
+	std::vector<std::string> sw = split(statwindows, ",");
+	for (unsigned i=0; i<sw.size(); i++) if (atoi(sw[i].c_str()) > 0) windows.push_back(atoi(sw[i].c_str()));
+	std::sort(windows.begin(), windows.end());
+	for (unsigned i=0; i<windows.size(); i++) currentwindows.push_back(new WindowStats(windows[i]));
+
+	//history tiers, the raw samples then PERIOD:RECORDS, period in milliseconds, increasing:
+	int historysamples = 4096;
+	std::string historytiers = "10:6000,1000:3600,60000:1440";
+	if (config.find("historysamples") != config.end()) historysamples = atoi(config["historysamples"].c_str());
+	if (config.find("historytiers") != config.end()) historytiers = config["historytiers"];
+	if (config.find("historypath") != config.end()) historypath = config["historypath"];
+	if (historysamples > 0) {
+		history.addTier(0, historysamples);
+		std::vector<std::string> ht = split(historytiers, ",");
+		unsigned last = 0;
+		for (unsigned i=0; i<ht.size(); i++) {
+			std::vector<std::string> pr = split(ht[i], ":");
+			if (pr.size() != 2) continue;
+			unsigned period = atoi(pr[0].c_str()), records = atoi(pr[1].c_str());
+			if ((period <= last) | (records == 0)) {
+				std::cout << "History tier " << ht[i] << " ignored, periods must increase." << std::endl;
+				continue;
+			}
+			history.addTier(period, records);
+			last = period;
+		}
+	}
 
 #ifdef USE_PIGPIOD_IF
 	std::string host = "localhost";
@@ -633,7 +1062,6 @@ std::string dccInit()
 	wave_clear(pigpio_id);
 	std::string wavelet_mode = "remote (" + host + ")";
 	signal(SIGINT, signal_handler);
-	ina.configure(pigpio_id);	
 	//ina.configure((const char *) host.c_str(), (const char *) port.c_str());
 #else
 	int result;
@@ -650,99 +1078,234 @@ std::string dccInit()
 	gpioWaveClear();
 	std::string wavelet_mode = "native";
 	gpioSetSignalFunc(SIGINT, signal_handler);
-	ina.configure();
 #endif
 
-	millisec = MILLISEC_INTERVAL; //no need to lock before thread start
+	sensor = makeSensor(sensor_type, sensor_address, config);
+
+	//programming tracks, 0 is the PROG pins and sensor.  The others are 
+	//progtrackN=pin1,pin2,enable,i2caddress[,sensortype], N = 1 to PROGTRACKS_MAX-1, the sensor 
+	//type defaulting to that of sensor:
+	progtracks.push_back(progtrack{ PROG1, PROG2, PROGENABLE, sensor_address, sensor, &samplering });
+	for (int n=1; n<PROGTRACKS_MAX; n++) {
+		std::string name = "progtrack" + std::to_string(n);
+		if (config.find(name) == config.end()) continue;
+		std::vector<std::string> pt = split(config[name], ",");
+		if ((pt.size() < 4) | (pt.size() > 5)) {
+			std::cout << "Malformed " << name << ", ignored." << std::endl;
+			continue;
+		}
+		int address = strtol(pt[3].c_str(), NULL, 0);
+		progtrack track{ atoi(pt[0].c_str()), atoi(pt[1].c_str()), atoi(pt[2].c_str()), address, 
+			makeSensor(pt.size() == 5 ? pt[4] : sensor_type, address, config), new SampleRing<1024>() };
+#ifdef USE_PIGPIOD_IF
+		set_mode(pigpio_id, track.pin1, PI_OUTPUT);
+		set_mode(pigpio_id, track.pin2, PI_OUTPUT);
+		set_mode(pigpio_id, track.enable, PI_OUTPUT);
+		gpio_write(pigpio_id, track.enable, 0);
+#else
+		gpioSetMode(track.pin1, PI_OUTPUT);
+		gpioSetMode(track.pin2, PI_OUTPUT);
+		gpioSetMode(track.enable, PI_OUTPUT);
+		gpioWrite(track.enable, 0);
+#endif
+		progtracks.push_back(track);
+	}
+
+	//the alert pin, active low, with the sensor's alert limit set to the overload threshold if it
+	//has one; otherwise the pin is driven by an external comparator:
+	if (alert_pin >= 0) {
+		if (!sensor->set_alert(protect_params.threshold)) 
+			std::cout << "Sensor " << sensor->name() << " has no programmable alert, alertpin expects an external comparator." << std::endl;
+#ifdef USE_PIGPIOD_IF
+		set_mode(pigpio_id, alert_pin, PI_INPUT);
+		set_pull_up_down(pigpio_id, alert_pin, PI_PUD_UP);
+		callback_ex(pigpio_id, alert_pin, FALLING_EDGE, protectAlert, NULL);
+#else
+		gpioSetMode(alert_pin, PI_INPUT);
+		gpioSetPullUpDown(alert_pin, PI_PUD_UP);
+		gpioSetAlertFuncEx(alert_pin, protectAlert, NULL);
+#endif
+	}
+
+	if (!cvcache.open(cvcachefile)) std::cout << "CV cache " << cvcachefile << " not available." << std::endl;
+
+	currentfd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+	if (currentfd < 0) return "Error: timerfd_create failed for the current monitor.";
+	for (unsigned i=1; i<progtracks.size(); i++) {
+		progtracks[i].timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+		if (progtracks[i].timerfd < 0) return "Error: timerfd_create failed for a programming track.";
+	}
+	setCurrentInterval(idle_interval);
 	currenting = true;
 	c = new std::thread(&runDCCCurrent);
 	set_thread_name(c, "current");
+	for (unsigned i=1; i<progtracks.size(); i++) {
+		progtracks[i].sampler = new std::thread(&runProgTrackCurrent, i);
+		set_thread_name(progtracks[i].sampler, "progcurrent");
+	}
 
 	std::stringstream resultstr;
 	resultstr << "outgpios: " << MAIN1 << "|" << MAIN2 << std::endl << "mode: " << wavelet_mode << std::endl;
 	return resultstr.str();
 }
 
-//depends on the prior creation of rwave by the caller...
-bool verifyBit(char rwave, float quiescent, unsigned cv, unsigned char bitpos, unsigned char val)
-{
-	char msg[256];
-	std::vector<float> currents;
-
-	DCCPacket p = DCCPacket::makeServiceModeDirectVerifyBitPacket(PROG1, PROG2, cv, bitpos, val);
+//Service mode session, used to hold the state that can be reused across a sequence of 
+//programming track operations, e.g., the CVs of a batch read.  The reset wave is created 
+//once and left resident, and the quiescent current is calibrated once at power-up, then
+//recalibrated only if the baseline current drifts.
+struct progsession {
+	char rwave;		//reset wave, resident for the session
+	int rmicros;		//duration of the reset wave
+	float quiescent;	//calibrated quiescent current
+	float baseline;		//baseline current observed at the head of the last verify chain
+	Baseline tracker;	//running median/MAD of the quiescent current, followed through the session
+	float confidence;	//ack detector confidence in the outcome of the last chain
+};
 
-#ifdef USE_PIGPIOD_IF
-	wave_add_generic(pigpio_id, p.getPulseTrain().size(), p.getPulseTrain().data());	
-	char pwave = wave_create(pigpio_id);
-#else
-	gpioWaveAddGeneric(p.getPulseTrain().size(), p.getPulseTrain().data());
-	char pwave = gpioWaveCreate();
-#endif
+//Service mode ack statistics, reported by the 'ps' command:
+struct progstatistics {
+	unsigned chains;	//ack chains sent
+	unsigned rechecks;	//bit verifies repeated for low confidence
+	unsigned retries;	//CV reads that failed the verify-byte and were walked again
+	unsigned speculations;	//CV reads that tried a predicted value before the bit walk
+	unsigned hits;		//speculative reads answered by the predicted value
+	unsigned writes;	//CV writes, counting each attempt
+	unsigned writeacks;	//writes confirmed by the decoder's write ack
+	unsigned writeverifies;	//writes confirmed by a verify-byte after no write ack
+	double confidence;	//sum of the chain confidences
+	float lowest;		//lowest chain confidence
+};
+progstatistics progstats = {0, 0, 0, 0, 0, 0, 0, 0, 0.0, 1.0};
 
-	std::vector<char> pchain = {
-		//S-9.2.3: 3 resets:
-		rwave, rwave, rwave,
-		//S-9.2.3: 5 writes:
-		pwave, pwave, pwave, pwave, pwave,
-		//S-9.2.3: 1 or more resets to cover ack period, if present:
-		rwave, rwave, rwave, rwave, rwave, rwave
-	};
+//collects the samples published to ring since position pos, passing each to the detector,
+//if provided.  Returns true if the detector has an outcome:
+bool progSamples(SampleRing<1024> &ring, uint64_t &pos, std::vector<float> &currents, AckDetector *detector)
+{
+	currentsample cs;
+	pos = ring.catchup(pos);
+	while (ring.read(pos, cs)) {
+		pos++;
+		currents.push_back(cs.current);
+		if (detector && detector->sample(cs.current, cs.tstamp)) return true;
+	}
+	return false;
+}
 
-	float max_current = 0.0;
-	int pwrcount = 0;
-	snprintf(msg, 256, "Verify CV%d bit %d = %d", cv, bitpos, val);
-	if (logging) log(msg);
+//sends a wave chain to the programming track, collecting the current samples published during
+//the chain until it's done.  If a detector is provided, each sample is passed to it, and the chain
+//is stopped early once it has an outcome:
+void progChain(std::vector<char> &chain, std::vector<float> &currents, AckDetector *detector = NULL)
+{
+	uint64_t pos = samplering.head();
+	int poll = 500 * sample_interval;  //check for new samples at twice the sampling rate
+	int enable = protection.state() == PROTECT_ON;  //no power to the track while tripped
 #ifdef USE_PIGPIOD_IF	
-	gpio_write(pigpio_id, PROGENABLE, 1); 
-	wave_chain(pigpio_id, pchain.data(), pchain.size());
-	while (wave_tx_busy(pigpio_id)) { currents.push_back(current); usleep(1000); }
+	gpio_write(pigpio_id, PROGENABLE, enable); 
+	wave_chain(pigpio_id, chain.data(), chain.size());
+	while (wave_tx_busy(pigpio_id)) { 
+		if (progSamples(samplering, pos, currents, detector)) { wave_tx_stop(pigpio_id); break; }
+		usleep(poll); 
+	}
 	gpio_write(pigpio_id, PROGENABLE, 0);
 #else
-	gpioWrite(PROGENABLE, 1);
-	gpioWaveChain(pchain.data(), pchain.size());
-	while (gpioWaveTxBusy()) { currents.push_back(current); usleep(1000); }
+	gpioWrite(PROGENABLE, enable);
+	gpioWaveChain(chain.data(), chain.size());
+	while (gpioWaveTxBusy()) { 
+		if (progSamples(samplering, pos, currents, detector)) { gpioWaveTxStop(); break; }
+		usleep(poll); 
+	}
 	gpioWrite(PROGENABLE, 0);
 #endif
+}
+
+//S-9.2.3 power-up sequence, 20 valid packets to stabilize the decoder, then calculate quiescent
+//from the last sample_count power-on current measurements:
+void progCalibrate(progsession &s)
+{
+	std::vector<float> currents;
+	std::vector<char> schain = {
+		s.rwave, s.rwave, s.rwave, s.rwave, s.rwave, 
+		s.rwave, s.rwave, s.rwave, s.rwave, s.rwave,
+		s.rwave, s.rwave, s.rwave, s.rwave, s.rwave,
+		s.rwave, s.rwave, s.rwave, s.rwave, s.rwave
+	};
 
-	float maxack = 0.0;
+	if (logging) log("prog: start 20 power up resets");
+	progChain(schain, currents);
+	if (logging) log("prog: 20 power up resets complete");
 
-	//count back from the end of sampling sample_count samples, find current measurements > quiescent + 60ma
+	s.tracker.clear();
 	for (int i=currents.size()-sample_count; i<currents.size(); i++) {
-		if (currents[i] > quiescent + ack_limit) {
-			pwrcount++; //S-9.2.3 60.0ma
-			maxack = currents[i];
-		}
+		if (i >= 0) s.tracker.add(currents[i]);
 	}
+	s.quiescent = s.baseline = s.tracker.median();
+
+	char msg[256];
+	snprintf(msg, 256, "prog: quiescent=%04.2fma, noise=%04.2fma, acklimit=%04.4fma, ackmin=%d", s.quiescent, s.tracker.noise(), ack_limit, ack_min);
+	if (logging) log(msg);
+}
+
+//starts a service mode session: throttles up the current monitor to support the ack resolution,
+//creates the resident reset wave and, if calibrate is true, does the power-up sequence:
+void progOpen(progsession &s, bool calibrate)
+{
+	DCCPacket r = DCCPacket::makeBaselineResetPacket(PROG1, PROG2);
+	s.rmicros = r.getMicros();
+
+	setCurrentInterval(sample_interval);
 	
-	//count back from the end of sampling sample_count samples, find current measurements > quiescent + 60ma
-	//for (int i=0; i<currents.size(); i++) {
-	//	if (currents[i] > quiescent + ack_limit) {
-	//		pwrcount++; //S-9.2.3 60.0ma
-	//		maxack = currents[i];
-	//	}
-	//}
-
-	if (pwrcount >= ack_min) { //S-9.2.3 6ms +/- 1ms
-		snprintf(msg, 256, "CV%d found %d in bit position %d (max=%04.2f, pc=%d)", cv, val, bitpos, maxack, pwrcount);
-		if (logging) log(msg);
-		val = 0;
-		return true;
+	s.quiescent = s.baseline = 800.0; //modified by progCalibrate() with a calculated value...
+	s.confidence = 1.0;
+	s.tracker.clear();
+
+#ifdef USE_PIGPIOD_IF
+	wave_clear(pigpio_id);
+	wave_add_generic(pigpio_id, r.getPulseTrain().size(), r.getPulseTrain().data());
+	s.rwave = wave_create(pigpio_id);
+#else
+	gpioWaveClear();
+	gpioWaveAddGeneric(r.getPulseTrain().size(), r.getPulseTrain().data());
+	s.rwave = gpioWaveCreate();
+#endif
+
+	if (calibrate) {
+		usleep(1000*MILLISEC_INTERVAL);
+		progCalibrate(s);
 	}
+}
 
-	snprintf(msg, 256, "CV%d did not find %d in bit position %d (max=%04.2f, pc=%d)", cv, val, bitpos, maxack, pwrcount);
-	if (logging) log(msg);
-	return false;
+//ends a service mode session, puts the current monitor interval back to normal:
+void progClose(progsession &s)
+{
+	setCurrentInterval(idle_interval);
+#ifdef USE_PIGPIOD_IF
+	wave_clear(pigpio_id);
+#else
+	gpioWaveClear();
+#endif
+}
 
+//recalibrates quiescent if the baseline measured at the head of the last verify chain has 
+//wandered more than drift_limit from the current calibration:
+void progCheckDrift(progsession &s)
+{
+	if (fabs(s.baseline - s.quiescent) > drift_limit) {
+		char msg[256];
+		snprintf(msg, 256, "prog: baseline drift %04.2fma -> %04.2fma, recalibrating", s.quiescent, s.baseline);
+		if (logging) log(msg);
+		progCalibrate(s);
+	}
 }
 
-//depends on the prior creation of rwave by the caller...
-bool verifyByte(char rwave, float quiescent, unsigned cv, unsigned char val)
+//sends the S-9.2.3 3 reset/5 packet/6 reset chain for packet p, and returns true if the decoder
+//acked.  The chain is stopped as soon as an ack is confirmed or the window closes without one.
+//pwrcount and maxack are set to the count and maximum of the samples in the ack plateau.  The
+//detector's confidence and the median current of the leading resets are posted to the session,
+//the latter for drift checking.
+bool ackChain(progsession &s, DCCPacket &p, float &maxack, int &pwrcount)
 {
-	char msg[256];
 	std::vector<float> currents;
 
-	DCCPacket p = DCCPacket::makeServiceModeDirectVerifyBytePacket(PROG1, PROG2, cv, val);
-
 #ifdef USE_PIGPIOD_IF
 	wave_add_generic(pigpio_id, p.getPulseTrain().size(), p.getPulseTrain().data());	
 	char pwave = wave_create(pigpio_id);
@@ -753,67 +1316,858 @@ bool verifyByte(char rwave, float quiescent, unsigned cv, unsigned char val)
 
 	std::vector<char> pchain = {
 		//S-9.2.3: 3 resets:
-		rwave, rwave, rwave,
+		s.rwave, s.rwave, s.rwave,
 		//S-9.2.3: 5 writes:
 		pwave, pwave, pwave, pwave, pwave,
 		//S-9.2.3: 1 or more resets to cover ack period, if present:
-		rwave, rwave, rwave, rwave, rwave, rwave
+		s.rwave, s.rwave, s.rwave, s.rwave, s.rwave, s.rwave
 	};
 
-	float max_current = 0.0;
-	int pwrcount = 0;
-	snprintf(msg, 256, "Verify CV%d value %d", cv, val);
-	if (logging) log(msg);
-#ifdef USE_PIGPIOD_IF	
-	gpio_write(pigpio_id, PROGENABLE, 1); 
-	wave_chain(pigpio_id, pchain.data(), pchain.size());
-	while (wave_tx_busy(pigpio_id)) { currents.push_back(current); usleep(1000); }
-	gpio_write(pigpio_id, PROGENABLE, 0);
+	uint64_t start = timestamp();
+	//a simulated sensor's decoder acks relative to the packets, as a decoder on the track would:
+	SimulatedSensor *sim = dynamic_cast<SimulatedSensor *>(sensor);
+	if (sim) sim->transmit(p.getPulseString(), p.getMicros(), start + 3*s.rmicros, 5);
+	ackparams params = { ack_limit, ack_sigma, 1000 * ack_min };
+	AckDetector detector(s.tracker, params,
+		start + s.rmicros,  //let the power-on inrush settle for one reset
+		start + 3*s.rmicros + 2*p.getMicros(), 
+		start + 3*s.rmicros + 5*p.getMicros() + 1000*ack_window
+	);
+	progChain(pchain, currents, &detector);
+
+	//the packet wave isn't needed past this chain; the reset wave stays for the session:
+#ifdef USE_PIGPIOD_IF
+	wave_delete(pigpio_id, pwave);
 #else
-	gpioWrite(PROGENABLE, 1);
-	gpioWaveChain(pchain.data(), pchain.size());
-	while (gpioWaveTxBusy()) { currents.push_back(current); usleep(1000); }
-	gpioWrite(PROGENABLE, 0);
+	gpioWaveDelete(pwave);
 #endif
 
-	float maxack = 0.0;
-
-	//count back from the end of sampling sample_count samples, find current measurements > quiescent + 60ma
-	for (int i=currents.size()-sample_count; i<currents.size(); i++) {
-		if (currents[i] > quiescent + ack_limit) {
-			pwrcount++; //S-9.2.3 60.0ma
-			maxack = currents[i];
-		}
+	maxack = detector.max();
+	pwrcount = detector.pwrcount();
+	s.confidence = detector.confidence();
+	progstats.chains++;
+	progstats.confidence += s.confidence;
+	if (s.confidence < progstats.lowest) progstats.lowest = s.confidence;
+
+	//baseline from the first sample_count samples, the leading resets:
+	std::vector<float> head(currents.begin(), currents.begin() + std::min((size_t) sample_count, currents.size()));
+	if (head.size() > 0) {
+		std::nth_element(head.begin(), head.begin() + head.size()/2, head.end());
+		s.baseline = head[head.size()/2];
 	}
-	
-	
-	//count back from the end of sampling sample_count samples, find current measurements > quiescent + 60ma
-	//for (int i=0; i<currents.size(); i++) {
-	//	if (currents[i] > quiescent + ack_limit) {
-	//		pwrcount++; //S-9.2.3 60.0ma
-	//		maxack = currents[i];
-	//	}
-	//}
-
-	if (pwrcount >= ack_min) { //S-9.2.3 6ms +/- 1ms
-		snprintf(msg, 256, "CV%d = %d (max=%04.2f, pc=%d)", cv, val, maxack, pwrcount);
+
+	char msg[256];
+	snprintf(msg, 256, "ack chain: %s in %ldus (baseline=%04.2fma, noise=%04.2fma, width=%dus, confidence=%0.2f)", 
+		detector.ack() ? "ack" : "no ack", (long) (timestamp() - start), 
+		s.tracker.median(), s.tracker.noise(), detector.width(), s.confidence);
+	if (logging) log(msg);
+
+	return detector.ack();
+}
+
+bool verifyBit(progsession &s, unsigned cv, unsigned char bitpos, unsigned char val)
+{
+	char msg[256];
+	float maxack;
+
+	DCCPacket p = DCCPacket::makeServiceModeDirectVerifyBitPacket(PROG1, PROG2, cv, bitpos, val);
+
+	snprintf(msg, 256, "Verify CV%d bit %d = %d", cv, bitpos, val);
+	if (logging) log(msg);
+
+	int pwrcount;
+	if (ackChain(s, p, maxack, pwrcount)) { //S-9.2.3 6ms +/- 1ms
+		snprintf(msg, 256, "CV%d found %d in bit position %d (max=%04.2f, pc=%d)", cv, val, bitpos, maxack, pwrcount);
 		if (logging) log(msg);
-		val = 0;
 		return true;
 	}
 
-	snprintf(msg, 256, "CV%d != %d (max=%04.2f, pc=%d)", cv, val, maxack, pwrcount);
+	snprintf(msg, 256, "CV%d did not find %d in bit position %d (max=%04.2f, pc=%d)", cv, val, bitpos, maxack, pwrcount);
 	if (logging) log(msg);
 	return false;
 
 }
 
+bool verifyByte(progsession &s, unsigned cv, unsigned char val)
+{
+	char msg[256];
+	float maxack;
 
-//global, used to run a single engine with adr/+/-:
-//int address=0, speed=0, direction=1;
-bool headlight=true;
+	DCCPacket p = DCCPacket::makeServiceModeDirectVerifyBytePacket(PROG1, PROG2, cv, val);
 
-std::string dccCommand(std::string cmd)
+	snprintf(msg, 256, "Verify CV%d value %d", cv, val);
+	if (logging) log(msg);
+
+	int pwrcount;
+	if (ackChain(s, p, maxack, pwrcount)) { //S-9.2.3 6ms +/- 1ms
+		snprintf(msg, 256, "CV%d = %d (max=%04.2f, pc=%d)", cv, val, maxack, pwrcount);
+		if (logging) log(msg);
+		return true;
+	}
+
+	snprintf(msg, 256, "CV%d != %d (max=%04.2f, pc=%d)", cv, val, maxack, pwrcount);
+	if (logging) log(msg);
+	return false;
+
+}
+
+//Speculative reads: most CVs hold their factory default or the value last read or written, so
+//a verify-byte of a predicted value, one chain, is tried before the bit walk, nine or more.  The
+//predictions come from, in order, the decoder's record in the CV cache, the last value read or
+//written for the CV, the profile for the manufacturer of the decoder (CV8), and the default profile.  Profiles are name=value files,
+//<cvprofilepath>/<CV8>.cvprofile and default.cvprofile, with the CV number as the name.
+
+//last value read or written, by CV:
+std::map<unsigned, int> lastcv;
+
+//profiles, loaded on first use, by manufacturer; -1 is the default profile:
+std::map<int, std::map<std::string, std::string> > cvprofiles;
+
+std::map<std::string, std::string> &cvProfile(int manufacturer)
+{
+	if (cvprofiles.find(manufacturer) == cvprofiles.end()) {
+		std::string name = "default";
+		if (manufacturer >= 0) name = std::to_string(manufacturer);
+		std::string filename = cvprofilepath + name + ".cvprofile";
+		if (fileExists(filename)) 
+			cvprofiles[manufacturer] = getConfig(filename);
+		else
+			cvprofiles[manufacturer] = std::map<std::string, std::string>();
+	}
+	return cvprofiles[manufacturer];
+}
+
+//Identity of the decoder on the programming track, learned from the CVs read or written in 
+//programming mode, and cleared when programming mode is entered or left.  Once the active address
+//(CV29 and CV1, or CV17/CV18) and CV7/CV8 are known, the decoder's record in the CV cache is
+//found or added, and the values collected so far are stored to it.
+struct decoderidentity {
+	int cv1, cv7, cv8, cv17, cv18, cv29;
+	int record;	//CV cache record, -1 until identified
+	std::map<unsigned, int> pending;  //values learned before the decoder was identified
+};
+decoderidentity progdecoder = {-1, -1, -1, -1, -1, -1, -1};
+
+void forgetDecoder()
+{
+	progdecoder = decoderidentity {-1, -1, -1, -1, -1, -1, -1};
+}
+
+//active address from CV29 bit 5 and either CV1 or CV17/CV18, -1 if not yet known:
+int decoderAddress(decoderidentity &d)
+{
+	if (d.cv29 < 0) return -1;
+	if (d.cv29 & 0x20) {
+		if ((d.cv17 < 0) | (d.cv18 < 0)) return -1;
+		return ((d.cv17 - 192) << 8) | d.cv18;
+	}
+	return d.cv1;
+}
+
+//records a CV value read from or written to the decoder on the programming track:
+void recordCV(unsigned cv, int value)
+{
+	lastcv[cv] = value;
+
+	if (cv == 1) progdecoder.cv1 = value;
+	else if (cv == 7) progdecoder.cv7 = value;
+	else if (cv == 8) progdecoder.cv8 = value;
+	else if (cv == 17) progdecoder.cv17 = value;
+	else if (cv == 18) progdecoder.cv18 = value;
+	else if (cv == 29) progdecoder.cv29 = value;
+
+	int address = decoderAddress(progdecoder);
+	if ((address > 0) & (progdecoder.cv7 >= 0) & (progdecoder.cv8 >= 0)) {
+		if (progdecoder.record < 0) {
+			progdecoder.record = cvcache.find(address, progdecoder.cv7, progdecoder.cv8);
+			if (progdecoder.record < 0) progdecoder.record = cvcache.add(address, progdecoder.cv7, progdecoder.cv8);
+			for (std::map<unsigned, int>::iterator it = progdecoder.pending.begin(); it != progdecoder.pending.end(); ++it)
+				cvcache.set(progdecoder.record, it->first, it->second);
+			progdecoder.pending.clear();
+		}
+		else cvcache.identify(progdecoder.record, address, progdecoder.cv7, progdecoder.cv8); //e.g., a new address written
+	}
+
+	if (progdecoder.record >= 0) 
+		cvcache.set(progdecoder.record, cv, value);
+	else
+		progdecoder.pending[cv] = value;
+}
+
+//returns up to speculate_max distinct predicted values for cv, most likely first:
+std::vector<int> predictCV(unsigned cv)
+{
+	std::vector<int> predictions;
+	std::vector<int> candidates;
+	std::string name = std::to_string(cv);
+
+	//until the decoder is identified, the most recent cache record for its address, if that's known:
+	int record = progdecoder.record;
+	if ((record < 0) & (decoderAddress(progdecoder) > 0)) record = cvcache.find(decoderAddress(progdecoder));
+
+	if (cvcache.get(record, cv) >= 0) candidates.push_back(cvcache.get(record, cv));
+	if (lastcv.find(cv) != lastcv.end()) candidates.push_back(lastcv[cv]);
+	if (lastcv.find(8) != lastcv.end()) {
+		std::map<std::string, std::string> &profile = cvProfile(lastcv[8]);
+		if (profile.find(name) != profile.end()) candidates.push_back(atoi(profile[name].c_str()));
+	}
+	std::map<std::string, std::string> &profile = cvProfile(-1);
+	if (profile.find(name) != profile.end()) candidates.push_back(atoi(profile[name].c_str()));
+
+	for (unsigned i=0; i<candidates.size(); i++) {
+		if (predictions.size() >= speculate_max) break;
+		if ((candidates[i] < 0) | (candidates[i] > 255)) continue;
+		if (std::find(predictions.begin(), predictions.end(), candidates[i]) == predictions.end())
+			predictions.push_back(candidates[i]);
+	}
+	return predictions;
+}
+
+//Using bit-verify to walk the bits of the CV, collecting the 1s and 0s
+//First, start with bit 0, and do a verify on both 0 and 1.  If no ack
+//is returned for both, then there's no locomotive on the programming track,
+//or the connection is bad.  If '1' verify succeeds, set byte accumulator
+//to 1, else if 0 succeeds, set byte accumulator to 0, then do the rest of 
+//the bits.
+//
+//The bit walk is only done if none of the predicted values verify with at least ack_confidence.
+//
+//Returns the CV value, or -1 if no ack was received.
+int readCV(progsession &s, unsigned cv)
+{
+	char msg[256];
+	int val;
+
+	std::vector<int> predictions = predictCV(cv);
+	if (predictions.size() > 0) progstats.speculations++;
+	for (unsigned i=0; i<predictions.size(); i++) {
+		if (verifyByte(s, cv, predictions[i]) & (s.confidence >= ack_confidence)) {
+			progstats.hits++;
+			snprintf(msg, 256, "Result: CV%d = %d (predicted)", cv, predictions[i]);
+			if (logging) log(msg);
+			recordCV(cv, predictions[i]);
+			return predictions[i];
+		}
+	}
+
+	//walk only 1-bits, verify byte; try up to three times:
+	int i;
+	bool verified = false;
+	for (i=1; i<=3; i++) {
+		//verify bit 0 by checking both for 1 and 0:
+		if (verifyBit(s, cv, 0, 1)) {
+			val = 1;
+		}
+		else if (verifyBit(s, cv, 0, 0)) {
+			val = 0;
+		}
+		else {
+			val = -1;
+			continue;
+		}
+
+		//the rest of the bits:
+		for (unsigned char i = 1; i < 8; i++) {
+			bool one = verifyBit(s, cv, i, 1);
+			if (s.confidence < ack_confidence) { //doubtful, repeat the bit rather than the whole walk
+				float c = s.confidence;
+				bool again = verifyBit(s, cv, i, 1);
+				progstats.rechecks++;
+				if (s.confidence > c) one = again;
+			}
+			if (one) {
+				val = val | 1<<i; //if a 1 is found, else leave the bit alone (0)
+			}
+		}
+		if ((verified = verifyByte(s, cv, val))) break;
+		progstats.retries++;
+	}
+	if (i > 3) i = 3;
+	if (i == 1)
+		snprintf(msg, 256, "read CV%d: %d attempt.", cv, i);
+	else
+		snprintf(msg, 256, "read CV%d: %d attempts.", cv, i);
+	if (logging) log(msg);
+
+	//a walked value that never verified is a failed read, kept out of the cache and predictions:
+	if (!verified) {
+		snprintf(msg, 256, "Result: CV%d unverified", cv);
+		if (logging) log(msg);
+		return -1;
+	}
+	snprintf(msg, 256, "Result: CV%d = %d", cv, val);
+	if (logging) log(msg);			
+
+	recordCV(cv, val);
+	return val;
+}
+
+//Reads the CVs that identify the decoder on the programming track, all in the one session: CV29
+//first, then CV17/CV18 if its long address bit is set, or CV1 if not, then CV7/CV8.  Returns the
+//active address, or -1 if it couldn't be read; the CVs read are left in progdecoder.
+int identifyDecoder(progsession &s)
+{
+	forgetDecoder();
+	int cv29 = readCV(s, 29);
+	if (cv29 < 0) return -1;
+	if (cv29 & 0x20) {
+		readCV(s, 17);
+		readCV(s, 18);
+	}
+	else readCV(s, 1);
+	readCV(s, 7);
+	readCV(s, 8);
+	return decoderAddress(progdecoder);
+}
+
+//writes value to cv with the S-9.2.3 3 reset/5 write/6 reset chain, watching for the decoder's
+//write ack.  A write with no confident ack is checked with a verify-byte, and only if that fails
+//too is the write sent again; up to three attempts.  Returns true if the value was confirmed.
+bool writeCV(progsession &s, unsigned cv, unsigned char value)
+{
+	char msg[256];
+	float maxack;
+	int pwrcount;
+	DCCPacket p =  DCCPacket::makeServiceModeDirectWriteBytePacket(PROG1, PROG2, cv, value);
+
+	for (int i=1; i<=3; i++) {
+		snprintf(msg, 256, "Write CV%d value %d, attempt %d", cv, value, i);
+		if (logging) log(msg);
+		progstats.writes++;
+
+		if (ackChain(s, p, maxack, pwrcount) & (s.confidence >= ack_confidence)) {
+			progstats.writeacks++;
+			snprintf(msg, 256, "Result: CV%d = %d (write ack)", cv, value);
+			if (logging) log(msg);
+			recordCV(cv, value);
+			return true;
+		}
+		progCheckDrift(s);
+		if (verifyByte(s, cv, value) & (s.confidence >= ack_confidence)) {
+			progstats.writeverifies++;
+			snprintf(msg, 256, "Result: CV%d = %d (verified)", cv, value);
+			if (logging) log(msg);
+			recordCV(cv, value);
+			return true;
+		}
+	}
+
+	snprintf(msg, 256, "Result: CV%d write of %d failed", cv, value);
+	if (logging) log(msg);
+	return false;
+}
+
+//Parallel service mode, the same read or write on the decoders on all the programming tracks at
+//once, for programming a batch of decoders.  Each chain is sent once for all the tracks, their 
+//packets merged into one wave by DCCPacket::merge(), and each track's samples are fed to its own
+//ack detector.  A track with nothing to do in a chain, e.g., its CV already read, gets a reset 
+//in place of the packet.  Reads are bit walks in lockstep; the speculation and the CV cache work
+//from the identity of a single decoder, and aren't used here.
+struct parallelsession {
+	char rwave;		//merged reset wave, resident for the session
+	int rmicros;		//duration of the merged reset wave
+	std::vector<progsession> s;	//per track quiescent, baseline, tracker and confidence
+};
+
+//collects the samples of all the programming tracks.  Returns true when every track with a
+//detector has an outcome, false if none have a detector:
+bool parallelSamples(std::vector<uint64_t> &pos, std::vector<std::vector<float> > &currents, std::vector<AckDetector *> &detectors, std::vector<bool> &decided)
+{
+	bool all = true, any = false;
+	for (unsigned i=0; i<progtracks.size(); i++) {
+		if (!decided[i]) decided[i] = progSamples(*progtracks[i].ring, pos[i], currents[i], detectors[i]);
+		if (detectors[i]) {
+			any = true;
+			if (!decided[i]) all = false;
+		}
+	}
+	return all & any;
+}
+
+//sends a wave chain to all the programming tracks, collecting each track's samples, the parallel
+//analog of progChain().  The chain is stopped early once every detector has an outcome:
+void parallelChain(std::vector<char> &chain, std::vector<std::vector<float> > &currents, std::vector<AckDetector *> &detectors)
+{
+	unsigned n = progtracks.size();
+	std::vector<uint64_t> pos(n);
+	std::vector<bool> decided(n, false);
+	for (unsigned i=0; i<n; i++) pos[i] = progtracks[i].ring->head();
+	currents.assign(n, std::vector<float>());
+	int poll = 500 * sample_interval;
+	int enable = protection.state() == PROTECT_ON;
+#ifdef USE_PIGPIOD_IF	
+	gpio_write(pigpio_id, PROGENABLE, enable); 
+	progTracksEnable(enable);
+	wave_chain(pigpio_id, chain.data(), chain.size());
+	while (wave_tx_busy(pigpio_id)) { 
+		if (parallelSamples(pos, currents, detectors, decided)) { wave_tx_stop(pigpio_id); break; }
+		usleep(poll); 
+	}
+	gpio_write(pigpio_id, PROGENABLE, 0);
+	progTracksEnable(0);
+#else
+	gpioWrite(PROGENABLE, enable);
+	progTracksEnable(enable);
+	gpioWaveChain(chain.data(), chain.size());
+	while (gpioWaveTxBusy()) { 
+		if (parallelSamples(pos, currents, detectors, decided)) { gpioWaveTxStop(); break; }
+		usleep(poll); 
+	}
+	gpioWrite(PROGENABLE, 0);
+	progTracksEnable(0);
+#endif
+}
+
+//starts a parallel session: creates the merged reset wave and does the power-up sequence, 
+//calibrating each track's quiescent current from its own samples:
+void parallelOpen(parallelsession &ps)
+{
+	unsigned n = progtracks.size();
+	std::vector<DCCPacket> resets;
+	for (unsigned i=0; i<n; i++) resets.push_back(DCCPacket::makeBaselineResetPacket(progtracks[i].pin1, progtracks[i].pin2));
+	DCCPacket r = DCCPacket::merge(resets);
+	ps.rmicros = r.getMicros();
+	ps.s.assign(n, progsession());
+
+	progparallel = true;
+	setCurrentInterval(sample_interval);
+
+#ifdef USE_PIGPIOD_IF
+	wave_clear(pigpio_id);
+	wave_add_generic(pigpio_id, r.getPulseTrain().size(), r.getPulseTrain().data());
+	ps.rwave = wave_create(pigpio_id);
+#else
+	gpioWaveClear();
+	gpioWaveAddGeneric(r.getPulseTrain().size(), r.getPulseTrain().data());
+	ps.rwave = gpioWaveCreate();
+#endif
+	usleep(1000*MILLISEC_INTERVAL);
+
+	std::vector<char> schain(20, ps.rwave);
+	std::vector<std::vector<float> > currents;
+	std::vector<AckDetector *> detectors(n, (AckDetector *) NULL);
+	if (logging) log("parallel prog: start 20 power up resets");
+	parallelChain(schain, currents, detectors);
+
+	char msg[256];
+	for (unsigned i=0; i<n; i++) {
+		progsession &s = ps.s[i];
+		s.rwave = ps.rwave;
+		s.rmicros = ps.rmicros;
+		s.confidence = 1.0;
+		s.tracker.clear();
+		for (int j=(int) currents[i].size()-sample_count; j<(int) currents[i].size(); j++) {
+			if (j >= 0) s.tracker.add(currents[i][j]);
+		}
+		s.quiescent = s.baseline = s.tracker.median();
+		snprintf(msg, 256, "parallel prog: track %d quiescent=%04.2fma, noise=%04.2fma", i, s.quiescent, s.tracker.noise());
+		if (logging) log(msg);
+	}
+}
+
+//ends a parallel session:
+void parallelClose(parallelsession &ps)
+{
+	progparallel = false;
+	setCurrentInterval(idle_interval);
+#ifdef USE_PIGPIOD_IF
+	wave_clear(pigpio_id);
+#else
+	gpioWaveClear();
+#endif
+}
+
+//sends the S-9.2.3 3 reset/5 packet/6 reset chain with packets[i] on each track i for which 
+//active[i] is set, and returns the acks by track.  Each active track's detector confidence is 
+//posted to its session:
+std::vector<bool> parallelAckChain(parallelsession &ps, std::vector<DCCPacket> &packets, std::vector<bool> &active)
+{
+	unsigned n = progtracks.size();
+	std::vector<bool> acks(n, false);
+	std::vector<DCCPacket> m;
+	for (unsigned i=0; i<n; i++) {
+		if (active[i]) m.push_back(packets[i]);
+		else m.push_back(DCCPacket::makeBaselineResetPacket(progtracks[i].pin1, progtracks[i].pin2));
+	}
+	DCCPacket p = DCCPacket::merge(m);
+
+#ifdef USE_PIGPIOD_IF
+	wave_add_generic(pigpio_id, p.getPulseTrain().size(), p.getPulseTrain().data());	
+	char pwave = wave_create(pigpio_id);
+#else
+	gpioWaveAddGeneric(p.getPulseTrain().size(), p.getPulseTrain().data());
+	char pwave = gpioWaveCreate();
+#endif
+
+	std::vector<char> pchain = {
+		ps.rwave, ps.rwave, ps.rwave,
+		pwave, pwave, pwave, pwave, pwave,
+		ps.rwave, ps.rwave, ps.rwave, ps.rwave, ps.rwave, ps.rwave
+	};
+
+	uint64_t start = timestamp();
+	ackparams params = { ack_limit, ack_sigma, 1000 * ack_min };
+	std::vector<AckDetector *> detectors(n, (AckDetector *) NULL);
+	for (unsigned i=0; i<n; i++) {
+		if (!active[i]) continue;
+		SimulatedSensor *sim = dynamic_cast<SimulatedSensor *>(progtracks[i].sensor);
+		if (sim) sim->transmit(packets[i].getPulseString(), p.getMicros(), start + 3*ps.rmicros, 5);
+		detectors[i] = new AckDetector(ps.s[i].tracker, params,
+			start + ps.rmicros,
+			start + 3*ps.rmicros + 2*p.getMicros(), 
+			start + 3*ps.rmicros + 5*p.getMicros() + 1000*ack_window
+		);
+	}
+	std::vector<std::vector<float> > currents;
+	parallelChain(pchain, currents, detectors);
+
+#ifdef USE_PIGPIOD_IF
+	wave_delete(pigpio_id, pwave);
+#else
+	gpioWaveDelete(pwave);
+#endif
+
+	char msg[256];
+	for (unsigned i=0; i<n; i++) {
+		if (!detectors[i]) continue;
+		progsession &s = ps.s[i];
+		acks[i] = detectors[i]->ack();
+		s.confidence = detectors[i]->confidence();
+		progstats.chains++;
+		progstats.confidence += s.confidence;
+		if (s.confidence < progstats.lowest) progstats.lowest = s.confidence;
+		snprintf(msg, 256, "parallel ack chain: track %d %s (baseline=%04.2fma, width=%dus, confidence=%0.2f)", 
+			i, acks[i] ? "ack" : "no ack", s.tracker.median(), detectors[i]->width(), s.confidence);
+		if (logging) log(msg);
+		delete detectors[i];
+	}
+	return acks;
+}
+
+//reads cv from the decoder on each programming track, a lockstep bit walk of all the tracks 
+//still unread, up to three attempts.  Returns the values by track, -1 for those not read:
+std::vector<int> parallelReadCV(parallelsession &ps, unsigned cv)
+{
+	unsigned n = progtracks.size();
+	std::vector<int> vals(n, -1);
+	std::vector<bool> active(n, true);
+	std::vector<DCCPacket> packets(n);
+
+	for (int attempt=1; attempt<=3; attempt++) {
+		std::vector<int> val(n, 0);
+		for (unsigned char bit=0; bit<8; bit++) {
+			for (unsigned i=0; i<n; i++) 
+				packets[i] = DCCPacket::makeServiceModeDirectVerifyBitPacket(progtracks[i].pin1, progtracks[i].pin2, cv, bit, 1);
+			std::vector<bool> acks = parallelAckChain(ps, packets, active);
+			for (unsigned i=0; i<n; i++) if (active[i] & acks[i]) val[i] |= 1<<bit;
+		}
+
+		for (unsigned i=0; i<n; i++) 
+			packets[i] = DCCPacket::makeServiceModeDirectVerifyBytePacket(progtracks[i].pin1, progtracks[i].pin2, cv, val[i]);
+		std::vector<bool> acks = parallelAckChain(ps, packets, active);
+		bool unread = false;
+		for (unsigned i=0; i<n; i++) {
+			if (!active[i]) continue;
+			if (acks[i] & (ps.s[i].confidence >= ack_confidence)) {
+				vals[i] = val[i];
+				active[i] = false;
+			}
+			else unread = true;
+		}
+		if (!unread) break;
+		progstats.retries++;
+	}
+	return vals;
+}
+
+//writes value to cv of the decoder on each programming track, with the ack check, verify and
+//retry of writeCV().  Returns the values by track, -1 for those that couldn't be confirmed:
+std::vector<int> parallelWriteCV(parallelsession &ps, unsigned cv, unsigned char value)
+{
+	unsigned n = progtracks.size();
+	std::vector<int> vals(n, -1);
+	std::vector<bool> active(n, true);
+	std::vector<DCCPacket> packets(n);
+
+	for (int attempt=1; attempt<=3; attempt++) {
+		for (unsigned i=0; i<n; i++) {
+			packets[i] = DCCPacket::makeServiceModeDirectWriteBytePacket(progtracks[i].pin1, progtracks[i].pin2, cv, value);
+			if (active[i]) progstats.writes++;
+		}
+		std::vector<bool> acks = parallelAckChain(ps, packets, active);
+		bool unconfirmed = false;
+		for (unsigned i=0; i<n; i++) {
+			if (!active[i]) continue;
+			if (acks[i] & (ps.s[i].confidence >= ack_confidence)) {
+				progstats.writeacks++;
+				vals[i] = value;
+				active[i] = false;
+			}
+			else unconfirmed = true;
+		}
+		if (!unconfirmed) break;
+
+		for (unsigned i=0; i<n; i++) 
+			packets[i] = DCCPacket::makeServiceModeDirectVerifyBytePacket(progtracks[i].pin1, progtracks[i].pin2, cv, value);
+		acks = parallelAckChain(ps, packets, active);
+		unconfirmed = false;
+		for (unsigned i=0; i<n; i++) {
+			if (!active[i]) continue;
+			if (acks[i] & (ps.s[i].confidence >= ack_confidence)) {
+				progstats.writeverifies++;
+				vals[i] = value;
+				active[i] = false;
+			}
+			else unconfirmed = true;
+		}
+		if (!unconfirmed) break;
+	}
+	return vals;
+}
+
+//parses a batch list of CVs, e.g., "1 7 8 17-18 29", into cvs, starting at cmdstring[first]; 
+//returns false if any element is malformed:
+bool parseCVList(std::vector<std::string> &cmdstring, unsigned first, std::vector<unsigned> &cvs)
+{
+	for (unsigned i=first; i<cmdstring.size(); i++) {
+		if (cmdstring[i].empty()) continue;
+		std::vector<std::string> range = split(cmdstring[i], "-");
+		int lo = atoi(range[0].c_str());
+		int hi = lo;
+		if (range.size() == 2) hi = atoi(range[1].c_str());
+		else if (range.size() > 2) return false;
+		if ((lo < 1) | (hi > 1024) | (lo > hi)) return false;
+		for (int cv = lo; cv <= hi; cv++) cvs.push_back(cv);
+	}
+	return cvs.size() > 0;
+}
+
+
+//global, used to run a single engine with adr/+/-:
+//int address=0, speed=0, direction=1;
+bool headlight=true;
+
+//Direct locomotive control, for the binary interfaces and the throttle and function commands.
+//An emergency stop is sent as such, and the roster keeps the locomotive at speed 0, so the
+//refresh sends it stop:
+int dccSetSpeed(unsigned address, int speed, int direction)
+{
+	bool s28 = steps28;  //once, as <D SPEED28|SPEED128> can change it on the worker
+	if ((address == 0) | (address > 10239) | (speed < -1) | (speed > (s28 ? 28 : 126))) return DCC_BADARG;
+	if (!running) return DCC_NOTRUNNING;
+	direction = direction != 0;
+
+	DCCPacket p;
+	if (s28)
+		p = DCCPacket::makeBaselineSpeedDirPacket(MAIN1, MAIN2, address, direction, speed, headlight);
+	else
+		p = DCCPacket::makeAdvancedSpeedDirPacket(MAIN1, MAIN2, address, direction, speed, headlight);
+	//with the queue full, the speed still goes to the roster, and out with the refresh:
+	if (!commandqueue.addCommand(p)) commandqueue.defer();
+	roster.update(address, speed < 0 ? 0 : speed, direction, headlight, speed < 0);
+	return DCC_OK;
+}
+
+//F0 is bit 4 of function group 1, F1-F4 bits 0-3; F5-F8 and F9-F12 are bits 0-3 of groups 2 and 3:
+static void functionGroups(uint32_t f, unsigned g[3])
+{
+	g[0] = ((f & 0x1) << 4) | ((f >> 1) & 0xf);
+	g[1] = (f >> 5) & 0xf;
+	g[2] = (f >> 9) & 0xf;
+}
+
+static uint32_t functionMap(roster_item &r)
+{
+	return ((r.fgroup1 >> 4) & 0x1) | ((r.fgroup1 & 0xf) << 1) | ((r.fgroup2 & 0xf) << 5) | ((r.fgroup3 & 0xf) << 9);
+}
+
+int dccSetFunctions(unsigned address, uint32_t functions, uint32_t mask)
+{
+	if ((address == 0) | (address > 10239) | ((mask & ~0x1fffu) != 0)) return DCC_BADARG;
+	roster_item r = roster.get(address);
+	unsigned values[3] = { r.fgroup1, r.fgroup2, r.fgroup3 };
+	unsigned gmask[3], gfunc[3];
+	functionGroups(mask, gmask);
+	functionGroups(functions, gfunc);
+	for (unsigned g=0; g<3; g++) {
+		if (gmask[g] == 0) continue;
+		unsigned value = (values[g] & ~gmask[g]) | (gfunc[g] & gmask[g]);
+		DCCPacket p = DCCPacket::makeAdvancedFunctionGroupPacket(MAIN1, MAIN2, address, value);
+		if (!commandqueue.addCommand(p)) return DCC_QUEUEFULL;
+		roster.setGroup(address, g+1, value);
+	}
+	return DCC_OK;
+}
+
+bool dccGetLoco(unsigned address, int &speed, int &direction, uint32_t &functions)
+{
+	roster_item r;
+	if (!roster.find(address, r)) return false;
+	speed = r.estop ? -1 : r.speed;
+	direction = r.direction;
+	functions = functionMap(r);
+	return true;
+}
+
+//The frequent commands, the throttle and function commands and the current polling, are parsed
+//and answered without allocation: the command is tokenized in place, dispatched through
+//cmdhandlers by its opcode character, and the response is formatted into the caller's buffer.
+//A handler returns the response length, or -1 for a command it doesn't handle, e.g., a longer 
+//opcode starting with the same character, which goes on to commandChain().
+typedef int (*cmdhandler)(cmdtokens &c, char *buf, size_t size);
+cmdhandler cmdhandlers[128];
+
+//formats a response into buf, truncated to fit, returns its length:
+int respond(char *buf, size_t size, const char *fmt, ...)
+{
+	va_list args;
+	va_start(args, fmt);
+	int n = vsnprintf(buf, size, fmt, args);
+	va_end(args);
+	if (n < 0) n = 0;
+	if ((size_t) n >= size) n = size - 1;
+	return n;
+}
+
+// throttle command: t addr spd dir
+//<t [1] (int address) (int speed) (0|1 direction)> - throttle comand, returns <T 1 (int speed) (1|0 direction)>
+int cmdThrottle(cmdtokens &c, char *buf, size_t size)
+{
+	int address, speed, direction;
+	if (c.tok[0].size() != 1) return -1;
+	if (!running) return respond(buf, size, "<Error: can't run in programming mode.>");
+	unsigned f = (c.n == 5) ? 2 : 1;
+	if (((c.n != 4) & (c.n != 5)) || !field(c.tok[f], address) || !field(c.tok[f+1], speed) || !field(c.tok[f+2], direction))
+		return respond(buf, size, "<Error: malformed command.>");
+	direction = direction != 0;
+	if (dccSetSpeed(address, speed, direction) != DCC_OK) return respond(buf, size, "<Error: malformed command.>");
+	return respond(buf, size, "<T 1 %d %d>", speed, direction);
+}
+
+//<f address byte [byte]> sets the functions F1-F12 using the constructed byte
+int cmdFunctionGroup(cmdtokens &c, char *buf, size_t size)
+{
+	int address, byte;
+	if (c.tok[0].size() != 1) return -1;
+	if ((c.n != 3) || !field(c.tok[1], address) || !field(c.tok[2], byte))
+		return respond(buf, size, "<Error: malformed command.>");
+	DCCPacket p = DCCPacket::makeAdvancedFunctionGroupPacket(MAIN1, MAIN2, address, byte);
+	if (!commandqueue.addCommand(p)) return respond(buf, size, "<Error: command queue full.>");
+	//the instruction prefix tells the group, for the roster's function state:
+	if ((byte & 0xe0) == 0x80) roster.setGroup(address, 1, byte);
+	else if ((byte & 0xf0) == 0xb0) roster.setGroup(address, 2, byte);
+	else if ((byte & 0xf0) == 0xa0) roster.setGroup(address, 3, byte);
+	return respond(buf, size, "");
+}
+
+//<F address function 1|0> command turns engine decoder functions ON and OFF
+int cmdFunction(cmdtokens &c, char *buf, size_t size)
+{
+	int address, func;
+	if (c.tok[0].size() != 1) return -1;
+	if ((c.n != 4) || !field(c.tok[1], address) || !field(c.tok[2], func))
+		return respond(buf, size, "<Error: malformed command.>");
+	bool state = c.tok[3] != "0";
+	if ((func < 0) | (func > 12)) return respond(buf, size, "");
+
+	if (dccSetFunctions(address, state ? 1u << func : 0, 1u << func) == DCC_QUEUEFULL) 
+		return respond(buf, size, "<Error: command queue full.>");
+	return respond(buf, size, "");
+}
+
+//RETURNS: <c "CurrentMAIN" CURRENT C "Milli" "0" MAX_MA "1" TRIP_MA >, CURRENT the mean over the 
+//shortest statistics window once there is one, rather than a single sample:
+int cmdCurrent(cmdtokens &c, char *buf, size_t size)
+{
+	if (c.tok[0].size() != 1) return -1;
+	float current = latest.load().current;
+	if (currentwindows.size() > 0) {
+		windowstats w = currentwindows[0]->load();
+		if (w.count > 0) current = w.mean;
+	}
+	if ((protection.state() == PROTECT_TRIPPED) | (protection.state() == PROTECT_LOCKOUT))
+		return respond(buf, size, "<c \"CurrentMAIN %g C Milli 0 2000 1 1800 2 OVERLOAD >", current);
+	return respond(buf, size, "<c \"CurrentMAIN %g C Milli 0 2000 1 1800 >", current);
+}
+
+//appease JMRI... No turnouts, no output pins, no sensors. 
+int cmdAppease(cmdtokens &c, char *buf, size_t size)
+{
+	if (c.tok[0].size() != 1) return -1;
+	return respond(buf, size, "<X>\n");
+}
+
+bool initCommands()
+{
+	cmdhandlers['t'] = cmdThrottle;
+	cmdhandlers['f'] = cmdFunctionGroup;
+	cmdhandlers['F'] = cmdFunction;
+	cmdhandlers['c'] = cmdCurrent;
+	cmdhandlers['T'] = cmdAppease;
+	cmdhandlers['Z'] = cmdAppease;
+	cmdhandlers['S'] = cmdAppease;
+	cmdhandlers['#'] = cmdAppease;
+	return true;
+}
+
+//the dispatch through cmdhandlers, -1 if the command isn't one of theirs:
+int dccDispatch(std::string_view cmd, char *buf, size_t size)
+{
+	static bool initialized = initCommands();
+	cmdtokens c;
+	if (!initialized || !tokenize(cmd, c)) return -1;
+	unsigned char op = c.tok[0][0];
+	if ((op >= 128) || (cmdhandlers[op] == NULL)) return -1;
+	return cmdhandlers[op](c, buf, size);
+}
+
+//the rest of the commands:
+std::string commandChain(std::string cmd, std::function<void(std::string)> stream);
+
+std::string dccLocoState(unsigned address)
+{
+	roster_item r;
+	char buf[64];
+	if (!roster.find(address, r)) return "";
+	int speedbyte;
+	if (r.estop) speedbyte = 1;  //emergency stop, a speed of -1
+	else speedbyte = (r.speed == 0) ? 0 : r.speed + 1;
+	if (r.direction) speedbyte |= 0x80;
+	snprintf(buf, 64, "<l %u 0 %d %u>", address, speedbyte, functionMap(r));
+	return buf;
+}
+
+bool dccConcurrent(const std::string &cmd)
+{
+	static const char *concurrent[] = { "t", "f", "F", "c", "T", "Z", "S", "#", "qs", "cs", "hq" };
+	cmdtokens c;
+	if (!tokenize(cmd, c)) return false;
+	for (unsigned i=0; i<sizeof(concurrent)/sizeof(concurrent[0]); i++) 
+		if (c.tok[0] == concurrent[i]) return true;
+	return false;
+}
+
+std::string dccCommand(std::string cmd, std::function<void(std::string)> stream)
+{
+	char buf[256];
+	int n = dccDispatch(cmd, buf, sizeof(buf));
+	if (n >= 0) return std::string(buf, n);
+	return commandChain(cmd, stream);
+}
+
+int dccCommand(const char *cmd, size_t len, char *response, size_t size, std::function<void(std::string)> stream)
+{
+	if (size == 0) return 0;
+	int n = dccDispatch(std::string_view(cmd, len), response, size);
+	if (n >= 0) return n;
+	std::string r = commandChain(std::string(cmd, len), stream);
+	n = std::min(r.size(), size-1);
+	memcpy(response, r.data(), n);
+	response[n] = '\0';
+	return n;
+}
+
+std::string commandChain(std::string cmd, std::function<void(std::string)> stream)
 {
 	cmd.erase(cmd.find_last_not_of(" \n\r\t")+1);
 	cmd.erase(std::remove(cmd.begin(), cmd.end(), '<'), cmd.end());
@@ -822,9 +2176,19 @@ std::string dccCommand(std::string cmd)
 
 	std::stringstream response;
 
-	//<1{ MAIN|PROG]> - turn on all|main|prog track(s), returns <p1[ MAIN|PROG]>
+	//<1{ MAIN|PROG]> - turn on all|main|prog track(s), returns <p1[ MAIN|PROG]>.  After an overload
+	//trip, power is restored by the protection, and a <1> is refused until then; from a lockout, 
+	//<1> restores power to the track that was on:
 	if (cmdstring[0] == "1") {
-		if (cmdstring.size() >= 2) {
+		if (protection.state() == PROTECT_TRIPPED) {
+			response << "<Error: overload trip, power restores in " << protectRemaining() << "ms.>";
+		}
+		else if (protection.state() == PROTECT_LOCKOUT) {
+			protectRestore(true);
+			if (running) response << "<p1 MAIN>";
+			else response << "<p1 PROG>";
+		}
+		else if (cmdstring.size() >= 2) {
 			if (cmdstring[1] == "MAIN") {
 				if (programming) {
 					response << "<Error: programming mode active.>";
@@ -837,9 +2201,8 @@ std::string dccCommand(std::string cmd)
 						gpioWaveClear();
 #endif
 						running = true;
-						vc.lock();
-						millisec = 1;
-						vc.unlock();
+						setCurrentInterval(sample_interval);
+						protectArm(true);
 						usleep(1000*MILLISEC_INTERVAL); //insure current monitoring before enabling power
 						t = new std::thread(&runDCC);
 						set_thread_name(t, "pulsetrain");
@@ -862,6 +2225,8 @@ std::string dccCommand(std::string cmd)
 				}
 				else {
 					programming = true;
+					forgetDecoder();
+					protectArm(true);
 					
 #ifdef USE_PIGPIOD_IF
 					wave_clear(pigpio_id);
@@ -888,14 +2253,11 @@ std::string dccCommand(std::string cmd)
 					gpioWaveClear();
 #endif
 					running = true;
-					vc.lock();
-					millisec = 1;
-					vc.unlock();
+					setCurrentInterval(sample_interval);
+					protectArm(true);
 					usleep(1000*MILLISEC_INTERVAL);
 					t = new std::thread(&runDCC);
 					set_thread_name(t, "pulsetrain");
-					vc.lock();
-					vc.unlock();
 #ifdef USE_PIGPIOD_IF
 					gpio_write(pigpio_id, PROGENABLE, 0);
 					gpio_write(pigpio_id, MAINENABLE, 1);
@@ -922,6 +2284,7 @@ std::string dccCommand(std::string cmd)
 				}
 				else {
 					running = false;
+					protectArm(false);
 #ifdef USE_PIGPIOD_IF
 					gpio_write(pigpio_id, MAINENABLE, 0);
 #else
@@ -933,9 +2296,7 @@ std::string dccCommand(std::string cmd)
 						t->~thread();
 						t = NULL;
 					}
-					vc.lock();
-					millisec = MILLISEC_INTERVAL;
-					vc.unlock();
+					setCurrentInterval(idle_interval);
 					response <<  "<p0 MAIN>\n";
 					
 					if (uptimelogging) {
@@ -956,6 +2317,8 @@ std::string dccCommand(std::string cmd)
 				}
 				else {
 					programming = false;
+					forgetDecoder();
+					protectArm(false);
 #ifdef USE_PIGPIOD_IF
 					gpio_write(pigpio_id, PROGENABLE, 0);
 #else
@@ -971,6 +2334,7 @@ std::string dccCommand(std::string cmd)
 		else { // turn off both/either
 			if (running) {
 				running = false;
+				protectArm(false);
 #ifdef USE_PIGPIOD_IF
 				gpio_write(pigpio_id, MAINENABLE, 0);
 #else
@@ -981,6 +2345,7 @@ std::string dccCommand(std::string cmd)
 					t->~thread();
 					t = NULL;
 				}
+				setCurrentInterval(idle_interval);
 				response <<  "<p0>\n";
 
 				if (uptimelogging) {
@@ -996,6 +2361,8 @@ std::string dccCommand(std::string cmd)
 			}
 			else if (programming) {
 				programming = false;
+				forgetDecoder();
+				protectArm(false);
 #ifdef USE_PIGPIOD_IF
 				gpio_write(pigpio_id, PROGENABLE, 0);
 #else
@@ -1025,103 +2392,6 @@ std::string dccCommand(std::string cmd)
 		}
 	}
 
-	// throttle command: t addr spd dir
-	//<t [1] (int address) (int speed) (0|1 direction)> - throttle comand, returns <T 1 (int speed) (1|0 direction)>
-	else if (cmdstring[0] == "t") {
-		int address, speed;
-		bool direction;
-		
-		if (running) {
-		
-			if (cmdstring.size() == 5) {
-				address = atoi(cmdstring[2].c_str());
-				speed = atoi(cmdstring[3].c_str());
-				direction = atoi(cmdstring[4].c_str());
-				response << "<T 1 " << speed << " " << direction << ">";
-			}
-			else if (cmdstring.size() == 4) {
-				address = atoi(cmdstring[1].c_str());
-				speed = atoi(cmdstring[2].c_str());
-				direction = atoi(cmdstring[3].c_str());
-				response << "<T 1 " << speed << " " << direction << ">";
-			}
-			else {
-				response << "<Error: malformed command.>";
-			}
-		
-			DCCPacket p;
-			
-			if (steps28)
-				p = DCCPacket::makeBaselineSpeedDirPacket(MAIN1, MAIN2, address, direction, speed, headlight);
-			else
-				p = DCCPacket::makeAdvancedSpeedDirPacket(MAIN1, MAIN2, address, direction, speed, headlight);
-				
-			//printf("%s\n", p.getPulseString().c_str());
-
-			commandqueue.addCommand(p);
-			roster.update(address, speed, direction, headlight);
-		} 
-		else response << "<Error: can't run in programming mode.>";
-	}
-	
-	//<f address byte [byte]> sets the functions F1-F12 using the constructed byte
-	else if (cmdstring[0] == "f") {
-		int address, byte;
-		DCCPacket p;
-		if (cmdstring.size() == 3) {
-			address = atoi(cmdstring[1].c_str());
-			byte = atoi(cmdstring[2].c_str());
-			p = DCCPacket::makeAdvancedFunctionGroupPacket(MAIN1, MAIN2, address, byte);
-			commandqueue.addCommand(p);
-		}
-		else {
-			response << "<Error: malformed command.>";
-		}
-		
-	}
-
-	//<F address function 1|0> command turns engine decoder functions ON and OFF
-	else if (cmdstring[0] == "F") {
-		int address, func;
-		bool state;
-		DCCPacket p;
-		if (cmdstring.size() == 4) {
-			address = atoi(cmdstring[1].c_str());
-			func = atoi(cmdstring[2].c_str());
-			if (cmdstring[3] == "0")
-				state = false;
-			else
-				state = true;
-			
-			roster_item r = roster.get(address);
-			
-			if ((func >=0) & (func <= 4)) {
-				if (func == 0) func = 4; else func -= 1;
-				if (state) r.fgroup1 |= 1 << func; else r.fgroup1 &= ~(1 << func);
-				p = DCCPacket::makeAdvancedFunctionGroupPacket(MAIN1, MAIN2, address, r.fgroup1);
-				roster.setGroup(address, 1, r.fgroup1);
-				commandqueue.addCommand(p);
-			}
-			else if ((func >=5) & (func <= 8)) {
-				func -= 5;
-				if (state) r.fgroup2 |= 1 << func; else r.fgroup2 &= ~(1 << func);
-				p = DCCPacket::makeAdvancedFunctionGroupPacket(MAIN1, MAIN2, address, r.fgroup2);
-				roster.setGroup(address, 2, r.fgroup2);
-				commandqueue.addCommand(p);
-			}
-			else if ((func >=9) & (func <= 12)) {
-				func -= 9;
-				if (state) r.fgroup3 |= 1 << func; else r.fgroup3 &= ~(1 << func);
-				p = DCCPacket::makeAdvancedFunctionGroupPacket(MAIN1, MAIN2, address, r.fgroup3);
-				roster.setGroup(address, 3, r.fgroup3);
-				commandqueue.addCommand(p);
-			}
-		}
-		else {
-			response << "<Error: malformed command.>";
-		}
-	}
-
 	
 	//<w (int address) (int cv) (int value) - write value to cv of address on the main track
 	//	
@@ -1136,12 +2406,13 @@ std::string dccCommand(std::string cmd)
 				value = atoi(cmdstring[3].c_str());
 				
 				DCCPacket p = DCCPacket::makeWriteCVToAddressPacket(MAIN1, MAIN2, address, cv, value);
-				commandqueue.addCommand(p);
-				commandqueue.addCommand(p);
-				commandqueue.addCommand(p);
-				commandqueue.addCommand(p);
+				if (commandqueue.addCommand(p, 4)) {
+					//no CV7/CV8 on the main, so only a decoder already in the cache can be updated:
+					cvcache.set(cvcache.find(address), cv, value);
 				
-				response << "<W " << address << " " << cv << " " << value <<">";
+					response << "<W " << address << " " << cv << " " << value <<">";
+				}
+				else response << "<Error: command queue full.>";
 			}
 			else {
 				response << "<Error: malformed command.>";
@@ -1151,86 +2422,70 @@ std::string dccCommand(std::string cmd)
 
 	}
 	
-	//<W cab>
-	//<W cv value>
+	//<W cab> - returns <W cab>
+	//<W cv value> - returns <W cv value>
+	//<W CV VALUE CALLBACKNUM CALLBACKSUB> - returns <r CALLBACKNUM|CALLBACKSUB|CV VALUE>
+	//the write is ack-checked, and the value is reported as -1 if it couldn't be confirmed
 	else if (cmdstring[0] == "W") {
 		if (programming) {
-			int address, cv, value;
-			
-			DCCPacket r = DCCPacket::makeBaselineResetPacket(PROG1, PROG2);
-			DCCPacket p;
+			int cv, value, cb, cbsub;
 		
 			if (cmdstring.size() == 2) {
-				address = atoi(cmdstring[1].c_str());
-				p =  DCCPacket::makeServiceModeDirectWriteBytePacket(PROG1, PROG2, 1, address);
-				response << "<W " << address  <<">";
+				cv = 1;
+				value = atoi(cmdstring[1].c_str());
 			}
-			else if (cmdstring.size() == 3) {
+			else if (cmdstring.size() == 3 | cmdstring.size() == 5) {
 				cv = atoi(cmdstring[1].c_str());
 				value = atoi(cmdstring[2].c_str());
-				p =  DCCPacket::makeServiceModeDirectWriteBytePacket(PROG1, PROG2, cv, value);
-				response << "<W " << cv  << " " << value << ">";
+				if (cmdstring.size() == 5) {
+					cb = atoi(cmdstring[3].c_str());
+					cbsub = atoi(cmdstring[4].c_str());
+				}
 			}
-			else return "Error: malformed command.";
-			
-			vc.lock();
-			millisec = 1;  //throttle up the current monitor to support the ack resolution
-			vc.unlock();
-			
-				
-#ifdef USE_PIGPIOD_IF
-			wave_clear(pigpio_id);
-			wave_add_generic(pigpio_id, r.getPulseTrain().size(), r.getPulseTrain().data());
-			char rwave = wave_create(pigpio_id);
-			wave_add_generic(pigpio_id, p.getPulseTrain().size(), p.getPulseTrain().data());
-			char pwave = wave_create(pigpio_id);
-			char pchain[14] = {
-				//S-9.2.3: 3 resets:
-				rwave, rwave, rwave,
-				//S-9.2.3: 5 writes:
-				pwave, pwave, pwave, pwave, pwave,
-				//S-9.2.3: 6 resets:
-				rwave, rwave, rwave, rwave, rwave, rwave
-			};
-			gpio_write(pigpio_id, PROGENABLE, 1);
-			wave_chain(pigpio_id, pchain , 14);
-			while (wave_tx_busy(pigpio_id)) usleep(1000);
-			gpio_write(pigpio_id, PROGENABLE, 0);
-			wave_delete(pigpio_id, rwave);
-			wave_delete(pigpio_id, pwave);
-				
-#else
-			gpioWaveClear();
-			gpioWaveAddGeneric(r.getPulseTrain().size(), r.getPulseTrain().data());
-			char rwave = gpioWaveCreate();
-			gpioWaveAddGeneric(p.getPulseTrain().size(), p.getPulseTrain().data());
-			char pwave = gpioWaveCreate();
-			char pchain[14] = {
-				//S-9.2.3: 3 resets:
-				rwave, rwave, rwave,
-				//S-9.2.3: 5 writes:
-				pwave, pwave, pwave, pwave, pwave,
-				//S-9.2.3: 6 resets:
-				rwave, rwave, rwave, rwave, rwave, rwave
-			};
-			gpioWrite(PROGENABLE, 1);
-			gpioWaveChain(pchain, 14);
-			while (gpioWaveTxBusy()) usleep(1000);
-			gpioWrite(PROGENABLE, 0);
-			gpioWaveDelete(rwave);
-			gpioWaveDelete(pwave);
-#endif
-
-			vc.lock();
-			millisec = MILLISEC_INTERVAL; 
-			vc.unlock();				
-				
+			else return "<Error: malformed command.>";
+			if ((cv < 1) | (cv > 1024) | (value < 0) | (value > 255)) return "<Error: malformed command.>";
 			
+			progsession s;
+			progOpen(s, true);  //the write ack is measured against the calibrated baseline
+			if (!writeCV(s, cv, value)) value = -1;
+			progClose(s);
+
+			if (cmdstring.size() == 2)
+				response << "<W " << value << ">";
+			else if (cmdstring.size() == 3)
+				response << "<W " << cv << " " << value << ">";
+			else
+				response << "<r " << cb << "|" << cbsub << "|" << cv << " " << value << ">";
 		}
 		else response << "<Error: can't program in ops mode.>";
 
 	}
 	
+	//<R> - read the locomotive address, returns <r address>, -1 if it couldn't be read
+	else if ((cmdstring[0] == "R") & (cmdstring.size() == 1)) {
+		if (programming) {
+			progsession s;
+			progOpen(s, true);
+			int address = identifyDecoder(s);
+			progClose(s);
+			response << "<r " << address << ">";
+		}
+		else response << "<Error: can't program in ops mode.>";
+	}
+
+	//wavedcc-unique, identify the decoder on the programming track in one power-up:
+	//<id> - returns <id address CV29 CV7 CV8>, -1 for any that couldn't be read
+	else if (cmdstring[0] == "id") {
+		if (programming) {
+			progsession s;
+			progOpen(s, true);
+			int address = identifyDecoder(s);
+			progClose(s);
+			response << "<id " << address << " " << progdecoder.cv29 << " " << progdecoder.cv7 << " " << progdecoder.cv8 << ">";
+		}
+		else response << "<Error: can't program in ops mode.>";
+	}
+
 	//read CV:
 	//<R CV CALLBACKNUM CALLBACKSUB> e.g., <R 32 0 0>
 	//short version - callback fields can be omitted
@@ -1238,8 +2493,6 @@ std::string dccCommand(std::string cmd)
 	else if (cmdstring[0] == "R") {
 		if (programming) {
 			int cv, cb, cbsub;
-			char msg[256];
-			std::vector<float> currents; //collect current measurements during power-up sequence
 
 			if (cmdstring.size() == 4) {
 				cv = atoi(cmdstring[1].c_str());
@@ -1251,153 +2504,148 @@ std::string dccCommand(std::string cmd)
 			}
 			else return "<Error: malformed command.>";
 
-			DCCPacket r = DCCPacket::makeBaselineResetPacket(PROG1, PROG2);
-			DCCPacket p;
-
-			vc.lock();
-			millisec = 1;  //throttle up the current monitor to support the ack resolution
-			vc.unlock();
-			usleep(1000*MILLISEC_INTERVAL);
-
-			float quiescent = 800.0; //this will be modified in a few lines with a calculated value...
+			progsession s;
+			progOpen(s, true);
+			int val = readCV(s, cv);
+			progClose(s);
 
-#ifdef USE_PIGPIOD_IF
-			wave_clear(pigpio_id);
-			wave_add_generic(pigpio_id, r.getPulseTrain().size(), r.getPulseTrain().data());
-			char rwave = wave_create(pigpio_id);
-
-			//S-9.2.3 power-up sequence, 20 valid packets to stabilize the decoder:
-			std::vector<char> schain = {
-				rwave, rwave, rwave, rwave, rwave, 
-				rwave, rwave, rwave, rwave, rwave,
-				rwave, rwave, rwave, rwave, rwave,
-				rwave, rwave, rwave, rwave, rwave
-			};
-
-			if (logging) log("read CV: start 20 power up resets");
-			gpio_write(pigpio_id, PROGENABLE, 1);
-			wave_chain(pigpio_id, schain.data(), schain.size());
-			while (wave_tx_busy(pigpio_id)) { currents.push_back(current); usleep(1000); }
-			gpio_write(pigpio_id, PROGENABLE, 0);
-			
-			
-#else
-			gpioWaveClear();
-			gpioWaveAddGeneric(r.getPulseTrain().size(), r.getPulseTrain().data());
-			char rwave = gpioWaveCreate();
-
-			//S-9.2.3 power-up sequence, 20 valid packets to stabilize the decoder:
-			std::vector<char> schain = {
-				rwave, rwave, rwave, rwave, rwave, 
-				rwave, rwave, rwave, rwave, rwave,
-				rwave, rwave, rwave, rwave, rwave,
-				rwave, rwave, rwave, rwave, rwave
-			};
-
-			if (logging) log("read CV: start 20 power up resets");
-			gpioWrite(PROGENABLE, 1);
-			gpioWaveChain(schain.data(), schain.size());
-			while (gpioWaveTxBusy()) { currents.push_back(current); usleep(1000); }
-			gpioWrite(PROGENABLE, 0);
-#endif
+			if (cmdstring.size() == 4) 
+				response << "<r " << cb << "|" << cbsub << "|" << (int) cv << " " << (int) val << ">";
+			else if (cmdstring.size() == 2 | cmdstring.size() == 3)
+				 response << "<r CV" << cv << "=" << (int) val << ">";
 
-			if (logging) log("read CV: 20 power up resets complete");
-			
+		}
+		else response << "<Error: can't program in ops mode.>";
+	}
 
-			//calculate quiescent from the last 10 power-on current measurements:
-			float q = 0.0;
-			for (int i=currents.size()-sample_count; i<currents.size(); i++) {
-				if (currents[i] > q) q = currents[i];
+	//wavedcc-unique, batch read CVs in one power-up session:
+	//<RB CV|CV-CV ...> e.g., <RB 1 7 8 17-18 29>, or <RB 1-256> for a decoder backup
+	//each result is streamed as <r CVn=value> as it completes; returns <RB (int read) (int failed)>
+	else if (cmdstring[0] == "RB") {
+		if (programming) {
+			std::vector<unsigned> cvs;
+			if (!parseCVList(cmdstring, 1, cvs)) return "<Error: malformed command.>";
+
+			int failed = 0;
+			progsession s;
+			progOpen(s, true);
+			for (unsigned i=0; i<cvs.size(); i++) {
+				int val = readCV(s, cvs[i]);
+				if (val < 0) failed++;
+				std::stringstream r;
+				r << "<r CV" << cvs[i] << "=" << val << ">";
+				if (stream) stream(r.str()); else response << r.str();
+				progCheckDrift(s);
 			}
-			quiescent = q;
-			
-			snprintf(msg, 256, "read CV%d: quiescent=%04.2fma, acklimit=%04.4fma, ackmin=%d", cv, quiescent, ack_limit, ack_min);
-			if (logging) log(msg);
-
-
-			//Using bit-verify to walk the bits of the CV, collecting the 1s and 0s
-			//First, start with bit 0, and do a verify on both 0 and 1.  If no ack
-			//is returned for both, then there's no locomotive on the programming track,
-			//or the connection is bad.  If '1' verify succeeds, set byte accumulator
-			//to 1, else if 0 succeeds, set byte accumulator to 0, then do the rest of 
-			//the bits.
-
-			unsigned val;
+			progClose(s);
+			response << "<RB " << cvs.size() - failed << " " << failed << ">";
+		}
+		else response << "<Error: can't program in ops mode.>";
+	}
 
+	//wavedcc-unique, batch write CVs in one power-up session:
+	//<WB CV=VALUE ...> e.g., <WB 1=3 29=6>
+	//each write is streamed as <W cv value> as it completes, value -1 if it couldn't be confirmed;
+	//returns <WB (int written) (int failed)>
+	else if (cmdstring[0] == "WB") {
+		if (programming) {
+			std::vector<std::pair<unsigned, unsigned> > writes;
+			for (unsigned i=1; i<cmdstring.size(); i++) {
+				if (cmdstring[i].empty()) continue;
+				std::vector<std::string> cvval = split(cmdstring[i], "=");
+				if (cvval.size() != 2) return "<Error: malformed command.>";
+				int cv = atoi(cvval[0].c_str());
+				int value = atoi(cvval[1].c_str());
+				if ((cv < 1) | (cv > 1024) | (value < 0) | (value > 255)) return "<Error: malformed command.>";
+				writes.push_back(std::make_pair(cv, value));
+			}
+			if (writes.size() == 0) return "<Error: malformed command.>";
+
+			int failed = 0;
+			progsession s;
+			progOpen(s, true);
+			for (unsigned i=0; i<writes.size(); i++) {
+				int value = writes[i].second;
+				if (!writeCV(s, writes[i].first, value)) { value = -1; failed++; }
+				std::stringstream r;
+				r << "<W " << writes[i].first << " " << value << ">";
+				if (stream) stream(r.str()); else response << r.str();
+				progCheckDrift(s);
+			}
+			progClose(s);
+			response << "<WB " << writes.size() - failed << " " << failed << ">";
+		}
+		else response << "<Error: can't program in ops mode.>";
+	}
 
-			//walk only 1-bits, verify byte; try up to four times:
-			int i;
-			for (i=1; i<=3; i++) {
-				//verify bit 0 by checking both for 1 and 0:
-				if (verifyBit(rwave, quiescent, cv, 0, 1)) {
-					val = 1;
-				}
-				else if (verifyBit(rwave, quiescent, cv, 0, 0)) {
-					val = 0;
-				}
-				else {
-					val = -1;
-					continue;
-				}
 
-				//the rest of the bits:
-				for (unsigned char i = 1; i < 8; i++) {
-					if (verifyBit(rwave, quiescent, cv, i, 1)) {
-						val = val | 1<<i; //if a 1 is found, else leave the bit alone (0)
-					}
+	//wavedcc-unique, parallel batch read of the decoders on all the programming tracks:
+	//<RP CV|CV-CV ...> e.g., <RP 1 7 8 29>
+	//each CV is streamed as <rp cv value0 value1 ...>, a value per track, -1 if it couldn't be read; 
+	//returns <RP (int read) (int failed)>, counting each track's CVs
+	else if (cmdstring[0] == "RP") {
+		if (programming) {
+			std::vector<unsigned> cvs;
+			if (!parseCVList(cmdstring, 1, cvs)) return "<Error: malformed command.>";
+
+			int read = 0, failed = 0;
+			parallelsession ps;
+			parallelOpen(ps);
+			for (unsigned i=0; i<cvs.size(); i++) {
+				std::vector<int> vals = parallelReadCV(ps, cvs[i]);
+				std::stringstream r;
+				r << "<rp " << cvs[i];
+				for (unsigned j=0; j<vals.size(); j++) {
+					r << " " << vals[j];
+					if (vals[j] < 0) failed++; else read++;
 				}
-				if (verifyByte(rwave, quiescent, cv, val)) break;
+				r << ">";
+				if (stream) stream(r.str()); else response << r.str();
 			}
-			if (i == 1)
-				snprintf(msg, 256, "read CV%d: %d attempt.", cv, i);
-			else
-				snprintf(msg, 256, "read CV%d: %d attempts.", cv, i);
-			if (logging) log(msg);
-
+			parallelClose(ps);
+			response << "<RP " << read << " " << failed << ">";
+		}
+		else response << "<Error: can't program in ops mode.>";
+	}
 
-/*			//walk both 1- and 0-bits:
-			for (unsigned char i = 0; i < 8; i++) {
-				bool foundone = verifyBit(rwave, quiescent, cv, i, 1);
-				bool foundzed = verifyBit(rwave, quiescent, cv, i, 0);
-				if (foundone & (!foundzed)) { 
-					val = val | 1<<i; // bit at pos is 1, set it in val 
-				} 
-				else if (foundone & foundzed) { 
-					val = -2; // strangeness... acklimit too low?
-					break; 
-				}
-				else if ((!foundone) & (!foundzed)) {
-					val = -1; // likely no locomotive or lost connection, maybe acklimit too high?
-					break; 
+	//wavedcc-unique, parallel batch write of the decoders on all the programming tracks:
+	//<WP CV=VALUE ...> e.g., <WP 1=3 29=6>
+	//each write is streamed as <wp cv value0 value1 ...>, a value per track, -1 if it couldn't be 
+	//confirmed; returns <WP (int written) (int failed)>, counting each track's CVs
+	else if (cmdstring[0] == "WP") {
+		if (programming) {
+			std::vector<std::pair<unsigned, unsigned> > writes;
+			for (unsigned i=1; i<cmdstring.size(); i++) {
+				if (cmdstring[i].empty()) continue;
+				std::vector<std::string> cvval = split(cmdstring[i], "=");
+				if (cvval.size() != 2) return "<Error: malformed command.>";
+				int cv = atoi(cvval[0].c_str());
+				int value = atoi(cvval[1].c_str());
+				if ((cv < 1) | (cv > 1024) | (value < 0) | (value > 255)) return "<Error: malformed command.>";
+				writes.push_back(std::make_pair(cv, value));
+			}
+			if (writes.size() == 0) return "<Error: malformed command.>";
+
+			int written = 0, failed = 0;
+			parallelsession ps;
+			parallelOpen(ps);
+			for (unsigned i=0; i<writes.size(); i++) {
+				std::vector<int> vals = parallelWriteCV(ps, writes[i].first, writes[i].second);
+				std::stringstream r;
+				r << "<wp " << writes[i].first;
+				for (unsigned j=0; j<vals.size(); j++) {
+					r << " " << vals[j];
+					if (vals[j] < 0) failed++; else written++;
 				}
-				// else bit at pos is 0 (!foundone & foundzed), leave it alone in val, which was initialized to all 0...
+				r << ">";
+				if (stream) stream(r.str()); else response << r.str();
 			}
-*/
-			
-			snprintf(msg, 256, "Result: CV%d = %d", cv, val);
-			if (logging) log(msg);			
-
-			vc.lock();
-			millisec = MILLISEC_INTERVAL;  //put the current monitor interval back to normal
-			vc.unlock();
-#ifdef USE_PIGPIOD_IF
-			wave_clear(pigpio_id);
-#else
-			gpioWaveClear();
-#endif
-
-			//printf("CV%d = %d\n",cv, val); //debug
-
-			if (cmdstring.size() == 4) 
-				response << "<r " << cb << "|" << cbsub << "|" << (int) cv << " " << (int) val << ">";
-			else if (cmdstring.size() == 2 | cmdstring.size() == 3)
-				 response << "<r CV" << cv << "=" << (int) val << ">";
-
+			parallelClose(ps);
+			response << "<WP " << written << " " << failed << ">";
 		}
 		else response << "<Error: can't program in ops mode.>";
 	}
 
-
 	//RETURNS: Track power status, Version, Microcontroller type, Motor Shield type, build number, and then any defined turnouts, outputs, or sensors.
 	//Example: <iDCC-EX V-3.0.4 / MEGA / STANDARD_MOTOR_SHIELD G-75ab2ab><H 1 0><H 2 0><H 3 0><H 4 0><Y 52 0><q 53><q 50>
 	else if (cmdstring[0] == "s") {
@@ -1414,6 +2662,108 @@ std::string dccCommand(std::string cmd)
 
 	}
 	
+	//wavedcc-unique, CV cache query, answered from the cache without going to the track:
+	//<cvc> - lists the decoders, <cvc address> - the known CVs of the decoder with the address,
+	//<cvc address cv> - returns <r CVn=value>, -1 if not known
+	else if (cmdstring[0] == "cvc") {
+		if (!cvcache.isopen()) response << "<Error: no CV cache.>";
+		else if (cmdstring.size() == 1) response << cvcache.list();
+		else {
+			int record = cvcache.find(atoi(cmdstring[1].c_str()));
+			if (cmdstring.size() == 2) 
+				response << cvcache.show(record);
+			else {
+				int cv = atoi(cmdstring[2].c_str());
+				response << "<r CV" << cv << "=" << cvcache.get(record, cv) << ">";
+			}
+		}
+	}
+
+	//wavedcc-unique, service mode statistics:
+	else if (cmdstring[0] == "ps") {
+		response << "ack chains: " << progstats.chains << "\n";
+		if (progstats.chains > 0) {
+			response << "ack confidence: mean " << progstats.confidence / progstats.chains << ", lowest " << progstats.lowest << "\n";
+		}
+		response << "bit rechecks: " << progstats.rechecks << "\n";
+		response << "read retries: " << progstats.retries << "\n";
+		response << "speculative reads: " << progstats.speculations << ", hits " << progstats.hits;
+		if (progstats.speculations > 0) response << " (" << (100 * progstats.hits) / progstats.speculations << "%)";
+		response << "\n";
+		response << "writes: " << progstats.writes << ", write acks " << progstats.writeacks << ", verified " << progstats.writeverifies << "\n";
+	}
+
+	//wavedcc-unique, current statistics, <cs WINDOW_MS SAMPLES MIN MAX MEAN RMS> for each window,
+	//milliamps, from the last complete window of that length:
+	else if (cmdstring[0] == "cs") {
+		for (unsigned i=0; i<currentwindows.size(); i++) {
+			windowstats w = currentwindows[i]->load();
+			response << "<cs " << currentwindows[i]->window() << " " << w.count << " " << w.min << " " << w.max << " " << w.mean << " " << w.rms << ">";
+			if (i < currentwindows.size()-1) response << "\n";
+		}
+	}
+
+	//wavedcc-unique, current history.  <hq> lists the tiers, <hq TIER PERIOD_MS RECORDS>; <hq TIER SECONDS>
+	//streams the records of the tier from the last SECONDS, <hq AGE COUNT MIN MAX MEAN VOLTAGE>, AGE
+	//seconds before now, currents milliamps, and returns <HQ records>:
+	else if (cmdstring[0] == "hq") {
+		if (cmdstring.size() == 1) {
+			for (unsigned i=0; i<history.tiers(); i++) {
+				response << "<hq " << i << " " << history.period(i) << " " << history.size(i) << ">";
+				if (i < history.tiers()-1) response << "\n";
+			}
+		}
+		else if (cmdstring.size() == 3) {
+			unsigned tier = atoi(cmdstring[1].c_str());
+			uint64_t now = timestamp();
+			uint64_t span = atof(cmdstring[2].c_str()) * 1000000;
+			uint64_t since = span < now ? now - span : 0;
+			unsigned n = history.query(tier, since, [&](historyrecord &r) {
+				char line[256];
+				snprintf(line, 256, "<hq -%.3f %u %.2f %.2f %.2f %.2f>", (now - r.tstamp) / 1000000.0, r.count, r.min, r.max, r.mean, r.voltage);
+				if (stream) stream(line); else response << line << "\n";
+			});
+			response << "<HQ " << n << ">";
+		}
+		else response << "<Error: malformed command.>";
+	}
+
+	//wavedcc-unique, dumps the current history to historypath, named by the time like the uptime
+	//files, in the binary layout of currenthistory.h; returns <hd filename records>:
+	else if (cmdstring[0] == "hd") {
+		char fname[256];
+		time_t rawtime;
+		struct tm *ftime;
+		time( &rawtime );
+		ftime = localtime( &rawtime );
+		strftime(fname,256,"%Y-%m-%d_%H:%M:%S.history", ftime);
+		std::string filename = historypath+std::string(fname);
+		int n = history.dump(filename);
+		if (n < 0) response << "<Error: can't write " << filename << ".>";
+		else response << "<hd " << filename << " " << n << ">";
+	}
+
+	//wavedcc-unique, overload protection state and trip statistics:
+	else if (cmdstring[0] == "op") {
+		static const char *states[] = { "off", "on", "tripped", "locked out" };
+		int state = protection.state();
+		protectstatistics protectstats = protection.statistics();
+		response << "protection: " << states[state] << ", threshold " << protect_params.threshold << "ma, " << protect_params.samples << " samples";
+		if (alert_pin >= 0) response << ", alert pin " << alert_pin;
+		response << "\n";
+		response << "trips: " << protectstats.trips << ", by alert " << protectstats.alerts << ", restores " << protectstats.restores << ", lockouts " << protectstats.lockouts << "\n";
+		if (protectstats.trips > 0) {
+			response << "trip latency: last " << protectstats.last << "us, worst " << protectstats.worst << "us\n";
+		}
+		if (state == PROTECT_TRIPPED) response << "backoff: " << protectstats.backoff << "ms\n";
+	}
+
+	//wavedcc-unique, command queue status, <qs QUEUED MAX ADDED REFUSED DEFERRED HIGHWATER>, packets;
+	//deferred are the refused speed packets left to the roster refresh:
+	else if (cmdstring[0] == "qs") {
+		response << commandqueue.status();
+	}
+
 	//wavedcc-unique, just sends power status.
 	else if (cmdstring[0] == "sp") {
 		if (running)
@@ -1426,27 +2776,6 @@ std::string dccCommand(std::string cmd)
 
 	}
 	
-	//RETURNS: <c "CurrentMAIN" CURRENT C "Milli" "0" MAX_MA "1" TRIP_MA >
-	else if (cmdstring[0] == "c") {
-		vc.lock();
-		float c = current;
-		vc.unlock();
-		if (overload_trip)
-			response << "<c \"CurrentMAIN " << c << " C Milli 0 2000 1 1800 2 OVERLOAD >";
-		else
-			response << "<c \"CurrentMAIN " << c << " C Milli 0 2000 1 1800 >";
-	}
-	
-	//appease JMRI... No turnouts, no output pins, no sensors. 
-	else if ((cmdstring[0] == "T") | (cmdstring[0] == "Z") | (cmdstring[0] == "S") | (cmdstring[0] == "#")) {
-		response << "<X>\n";
-	}
-	
-	//Appease JMRI, <#> request max slots, not documented in DCC++ EX.  Reply is just a large number.
-	else if (cmdstring[0] == "#") {
-		response << "<# 1000d>\n";
-	}
-	
 	else if (cmdstring[0] == "ws") {
 #ifdef USE_PIGPIOD_IF
 		response << "Remote hardware version: " << get_hardware_revision(pigpio_id) << "\n";
@@ -1538,6 +2867,7 @@ std::string dccCommand(std::string cmd)
 
 void dccFinish()
 {
+	cvcache.close();
 	running = false;
 	if (t && t->joinable()) {
 		t->join();
@@ -19,9 +19,41 @@
 #ifndef __DCCENGINE_H__
 #define __DCCENGINE_H__
 
+#include <stdint.h>
+#include <string>
+#include <functional>
 
 std::string dccInit();
-std::string dccCommand(std::string cmd); //goes in some sort of loop to feed it commands...
+//goes in some sort of loop to feed it commands...  Commands that produce a sequence of results, e.g., 
+//the batch CV reads, pass each one to stream as it completes, if provided; otherwise they're
+//accumulated in the returned response.
+std::string dccCommand(std::string cmd, std::function<void(std::string)> stream = nullptr);
+//the same, with the response written to the caller's buffer of size bytes, NUL-terminated and 
+//truncated to fit, and its length returned.  The frequent commands are parsed and answered 
+//without allocating:
+int dccCommand(const char *cmd, size_t len, char *response, size_t size, std::function<void(std::string)> stream = nullptr);
+//The engine runs one command at a time.  A caller with more than one thread has to run them all
+//on one, with the exception of the commands for which this is true: the throttle, function and
+//current commands and the other frequent ones, which only touch the locked command queue and
+//roster and the published current samples, and can run on another thread alongside.  The rest
+//change or read the power, mode and programming state, and the service mode commands and power
+//on take up to seconds.  The direct locomotive control below is concurrent, like the throttle
+//and function commands:
+bool dccConcurrent(const std::string &cmd);
+//a locomotive's speed, direction and functions as a DCC-EX <l cab 0 speedbyte functionmap> 
+//broadcast, or "" if the address isn't in the roster:
+std::string dccLocoState(unsigned address);
+
+//Direct locomotive control, for the binary interfaces, without the text commands; see dccConcurrent():
+enum dccresult { DCC_OK, DCC_NOTRUNNING, DCC_QUEUEFULL, DCC_BADARG };
+//as <t address speed direction>, speed 0-28 in the default 28 step mode, 0-126 after <D SPEED128>,
+//or -1 for emergency stop:
+int dccSetSpeed(unsigned address, int speed, int direction);
+//sets the functions F0-F12 selected by mask, bit n for Fn, to their bits in functions:
+int dccSetFunctions(unsigned address, uint32_t functions, uint32_t mask);
+//the locomotive's state in the roster, functions as for dccSetFunctions(); false if it isn't there:
+bool dccGetLoco(unsigned address, int &speed, int &direction, uint32_t &functions);
+
 void dccFinish();
 
 #endif
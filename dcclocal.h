@@ -0,0 +1,180 @@
+/*
+    This file is part of wavedcc,
+    Copyright (C) 2021 Glenn Butcher.
+
+    wavedcc is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    wavedcc is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with wavedcc.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __DCCLOCAL_H__
+#define __DCCLOCAL_H__
+
+#include <stdint.h>
+#include <atomic>
+
+//Binary locomotive control for clients on the same host as wavedccd, over its Unix-domain socket
+//(-l path), or a shared-memory command ring set up through it.  The records are in host byte 
+//order, as they never leave the machine.
+//
+//On the socket, a SOCK_SEQPACKET, each message is a dcclocalheader and its records.  A 
+//DCCLOCAL_COMMANDS message of count dcclococommands is answered with a DCCLOCAL_STATUS message
+//of count dcclocostatus records, one per command, in order.  A DCCLOCAL_RING message asks for a
+//ring of count slots, a power of two; the reply is a DCCLOCAL_RING header, count the slots 
+//granted, 0 if none, carrying two descriptors as SCM_RIGHTS: the ring's memory, to be mapped 
+//with dccringsize(count) bytes, and an eventfd, the doorbell.
+#define DCCLOCAL_COMMANDS 1
+#define DCCLOCAL_STATUS 2
+#define DCCLOCAL_RING 3
+
+#define DCCLOCAL_MAXRECORDS 256	//records per message
+#define DCCLOCAL_MAXSLOTS 65536
+
+struct dcclocalheader {
+	uint32_t op;
+	uint32_t count;
+};
+
+//dcclococommand flags:
+#define DCCLOCAL_SPEED 0x01	//sets the speed and direction
+#define DCCLOCAL_FORWARD 0x02
+
+struct dcclococommand {
+	uint16_t address;
+	int8_t speed;		//0-28, or 0-126 in 128 step mode, -1 for emergency stop
+	uint8_t flags;
+	uint32_t functions;	//F0-F12, bit n for Fn
+	uint32_t fmask;		//the functions to set
+};
+
+struct dcclocostatus {
+	uint16_t address;
+	int8_t speed;		//as in the roster after the command
+	uint8_t direction;
+	uint32_t functions;
+	uint32_t result;	//dccresult, per dccengine.h
+};
+
+//A shared-memory ring of commands from one client, run by wavedccd in order.  The client writes
+//a command to the slot at head and advances head; wavedccd runs it, writes its result into the 
+//slot and advances tail, so the result of the command at position n is good from when tail 
+//passes n until the client reuses the slot.  There's one writer per ring: threads of a client
+//that share one serialize their push()es.
+//
+//wavedccd sleeps in epoll_wait() between batches, with armed set; push() rings the doorbell 
+//only then, so a client sending a burst makes one write() to wake it, not one per command.
+//
+//Both sides construct the DCCRing with the slots granted.  The header is in memory the client
+//can write, so wavedccd indexes the slots with its own count and keeps its own copy of tail, 
+//passed to its methods; a head more than slots ahead of it is an error.
+struct dccringheader {
+	uint32_t magic;
+	uint32_t slots;
+	alignas(64) std::atomic<uint64_t> head;		//written by the client
+	alignas(64) std::atomic<uint64_t> tail;		//written by wavedccd
+	std::atomic<uint32_t> armed;
+};
+
+struct dccringslot {
+	dcclococommand command;
+	uint32_t result;
+};
+
+#define DCCRING_MAGIC 0x474e5244  //"DRNG"
+
+inline size_t dccringsize(uint32_t slots)
+{
+	return sizeof(dccringheader) + slots * sizeof(dccringslot);
+}
+
+class DCCRing
+{
+public:
+	//slots a power of two:
+	DCCRing(void *mem, uint32_t slots)
+	{
+		h = (dccringheader *) mem;
+		s = (dccringslot *) ((char *) mem + sizeof(dccringheader));
+		n = slots;
+	}
+
+	//wavedccd's side:
+	void init()
+	{
+		h->magic = DCCRING_MAGIC;
+		h->slots = n;
+		h->head = 0;
+		h->tail = 0;
+		h->armed = 1;
+	}
+
+	//copies the command at tail to c; returns 1, 0 if there's none, or -1 if head is past what
+	//the client could have written:
+	int next(uint64_t tail, dcclococommand &c)
+	{
+		uint64_t hd = h->head.load(std::memory_order_acquire);
+		if (hd == tail) return 0;
+		if (hd - tail > n) return -1;
+		c = s[tail & (n-1)].command;
+		return 1;
+	}
+
+	//the result of the command at tail, which makes its slot free:
+	void done(uint64_t tail, uint32_t result)
+	{
+		s[tail & (n-1)].result = result;
+		h->tail.store(tail+1, std::memory_order_release);
+	}
+
+	//before sleeping: true if a command came in the meantime, and the ring has to be run again:
+	bool arm(uint64_t tail)
+	{
+		h->armed.store(1, std::memory_order_seq_cst);
+		return tail != h->head.load(std::memory_order_seq_cst);
+	}
+
+	//the client's side.  Adds a command, its position to pos; false if the ring is full.  Sets
+	//wake if wavedccd is asleep, and the doorbell has to be rung:
+	bool push(const dcclococommand &c, uint64_t &pos, bool &wake)
+	{
+		uint64_t hd = h->head.load(std::memory_order_relaxed);
+		if (hd - h->tail.load(std::memory_order_acquire) >= n) return false;
+		s[hd & (n-1)].command = c;
+		h->head.store(hd+1, std::memory_order_seq_cst);
+		wake = h->armed.exchange(0, std::memory_order_seq_cst) != 0;
+		pos = hd;
+		return true;
+	}
+
+	//true once the command at pos has been run:
+	bool complete(uint64_t pos)
+	{
+		return h->tail.load(std::memory_order_acquire) > pos;
+	}
+
+	uint32_t result(uint64_t pos)
+	{
+		return s[pos & (n-1)].result;
+	}
+
+	bool valid()
+	{
+		return (h->magic == DCCRING_MAGIC) & (h->slots == n);
+	}
+
+private:
+	dccringheader *h;
+	dccringslot *s;
+	uint32_t n;
+};
+
+#endif
@@ -0,0 +1,306 @@
+/*
+    This file is part of wavedcc,
+    Copyright (C) 2021 Glenn Butcher.
+
+    wavedcc is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    wavedcc is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with wavedcc.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+//Local interface benchmark: sends throttle commands to a running wavedccd over its TCP port as
+//DCC++ text, over its Unix-domain socket as dcclococommands, and through a shared-memory ring,
+//and, with -B, over its binary port, per dccbinary.h, and reports the commands per second of 
+//each, pipelined, and the round-trip latency of one command at a time.  The commands cycle 
+//through the speeds of the addresses 1..a.
+//
+//usage: dcclocalbench [-n commands] [-a addresses] [-b batch] [-p port] [-B port] socketpath
+//	-n: commands per test, default 10000
+//	-a: locomotive addresses, default 8
+//	-b: commands per message or binary frame, default 64
+//	-p: wavedccd's TCP port, default 9034
+//	-B: wavedccd's binary port, for a binary test
+//
+//wavedccd has to be started with -l socketpath, and, for the TCP rate to mean anything, with
+//-r speed=0, as its default rate limit holds the excess speed commands of a client.  With MAIN
+//off the commands are refused, which still exercises both paths; with it on, every command 
+//queues a packet, so only on a bench track.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sched.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/mman.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include "dcclocal.h"
+#include "dccbinary.h"
+
+uint64_t now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec*(uint64_t)1000000000+ts.tv_nsec;
+}
+
+int n = 10000, addresses = 8, batch = 64;
+
+dcclococommand command(int i)
+{
+	dcclococommand c;
+	c.address = i % addresses + 1;
+	c.speed = (i / addresses) % 127;
+	c.flags = DCCLOCAL_SPEED | DCCLOCAL_FORWARD;
+	c.functions = 0;
+	c.fmask = 0;
+	return c;
+}
+
+void report(const char *name, uint64_t elapsed, std::vector<uint64_t> &latency)
+{
+	std::sort(latency.begin(), latency.end());
+	printf("%-12s %10.0f commands/s   latency median %7.1fus  99%% %7.1fus\n", name, n * 1e9 / elapsed,
+	       latency[latency.size()/2] / 1e3, latency[latency.size()*99/100] / 1e3);
+}
+
+//reads replies until count of them, each ending in '>', have come in:
+void tcpReplies(int fd, int count)
+{
+	char buf[65536];
+	while (count > 0) {
+		ssize_t r = recv(fd, buf, sizeof(buf), 0);
+		if (r <= 0) { perror("tcp"); exit(1); }
+		for (ssize_t i=0; i<r; i++) if (buf[i] == '>') count--;
+	}
+}
+
+int tcpConnect(int port)
+{
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (connect(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) { perror("connect"); exit(1); }
+	int yes = 1;
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+	return fd;
+}
+
+void benchTCP(int port)
+{
+	int fd = tcpConnect(port);
+	char cmd[64];
+	uint64_t t1 = now();
+	for (int i=0; i<n; i += batch) {
+		std::string b;
+		int m = std::min(batch, n - i);
+		for (int j=0; j<m; j++) {
+			dcclococommand c = command(i+j);
+			b += std::string(cmd, snprintf(cmd, sizeof(cmd), "<t 1 %d %d 1>", c.address, c.speed));
+		}
+		if (send(fd, b.data(), b.size(), 0) < 0) { perror("tcp"); exit(1); }
+		tcpReplies(fd, m);
+	}
+	uint64_t elapsed = now() - t1;
+
+	std::vector<uint64_t> latency;
+	for (int i=0; i<n/10; i++) {
+		dcclococommand c = command(i);
+		int len = snprintf(cmd, sizeof(cmd), "<t 1 %d %d 1>", c.address, c.speed);
+		uint64_t t = now();
+		if (send(fd, cmd, len, 0) < 0) { perror("tcp"); exit(1); }
+		tcpReplies(fd, 1);
+		latency.push_back(now() - t);
+	}
+	close(fd);
+	report("tcp text", elapsed, latency);
+}
+
+//sends count commands from i in one frame, and waits for the status records:
+void binarySend(int fd, int i, int count)
+{
+	char buf[sizeof(uint16_t) + sizeof(dccbinaryheader) + DCCLOCAL_MAXRECORDS * sizeof(dcclocostatus)];
+	uint16_t len = htons(sizeof(dccbinaryheader) + count * sizeof(dcclococommand));
+	memcpy(buf, &len, sizeof(len));
+	dccbinaryheader h = { DCCBINARY_COMMANDS, 0, htons((uint16_t) i) };
+	memcpy(buf + sizeof(len), &h, sizeof(h));
+	dcclococommand *c = (dcclococommand *) (buf + sizeof(len) + sizeof(h));
+	for (int j=0; j<count; j++) {
+		c[j] = command(i+j);
+		dccbinarySwap(c[j]);
+	}
+	if (send(fd, buf, sizeof(len) + sizeof(h) + count * sizeof(dcclococommand), 0) < 0) { perror("binary"); exit(1); }
+
+	size_t want = sizeof(len) + sizeof(h) + count * sizeof(dcclocostatus), got = 0;
+	while (got < want) {
+		ssize_t r = recv(fd, buf + got, want - got, 0);
+		if (r <= 0) { perror("binary"); exit(1); }
+		got += r;
+	}
+}
+
+void benchBinary(int port)
+{
+	int fd = tcpConnect(port);
+	uint64_t t1 = now();
+	for (int i=0; i<n; i += batch) binarySend(fd, i, std::min(batch, n - i));
+	uint64_t elapsed = now() - t1;
+
+	std::vector<uint64_t> latency;
+	for (int i=0; i<n/10; i++) {
+		uint64_t t = now();
+		binarySend(fd, i, 1);
+		latency.push_back(now() - t);
+	}
+	close(fd);
+	report("tcp binary", elapsed, latency);
+}
+
+int localConnect(const char *path)
+{
+	int fd = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, path, sizeof(addr.sun_path)-1);
+	if (connect(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) { perror("connect"); exit(1); }
+	return fd;
+}
+
+//sends count commands from i in one message, and waits for the status records:
+void localSend(int fd, int i, int count)
+{
+	char buf[sizeof(dcclocalheader) + DCCLOCAL_MAXRECORDS * sizeof(dcclocostatus)];
+	*(dcclocalheader *) buf = dcclocalheader{ DCCLOCAL_COMMANDS, (uint32_t) count };
+	dcclococommand *c = (dcclococommand *) (buf + sizeof(dcclocalheader));
+	for (int j=0; j<count; j++) c[j] = command(i+j);
+	if (send(fd, buf, sizeof(dcclocalheader) + count * sizeof(dcclococommand), 0) < 0) { perror("local"); exit(1); }
+	if (recv(fd, buf, sizeof(buf), 0) != (ssize_t) (sizeof(dcclocalheader) + count * sizeof(dcclocostatus))) {
+		fprintf(stderr, "local: short reply\n");
+		exit(1);
+	}
+}
+
+void benchLocal(const char *path)
+{
+	int fd = localConnect(path);
+	uint64_t t1 = now();
+	for (int i=0; i<n; i += batch) localSend(fd, i, std::min(batch, n - i));
+	uint64_t elapsed = now() - t1;
+
+	std::vector<uint64_t> latency;
+	for (int i=0; i<n/10; i++) {
+		uint64_t t = now();
+		localSend(fd, i, 1);
+		latency.push_back(now() - t);
+	}
+	close(fd);
+	report("unix socket", elapsed, latency);
+}
+
+void benchRing(const char *path)
+{
+	int fd = localConnect(path);
+	uint32_t slots = 1024;
+	dcclocalheader h = { DCCLOCAL_RING, slots };
+	if (send(fd, &h, sizeof(h), 0) < 0) { perror("ring"); exit(1); }
+
+	struct iovec iov = { &h, sizeof(h) };
+	struct msghdr msg;
+	char control[CMSG_SPACE(2 * sizeof(int))];
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+	if ((recvmsg(fd, &msg, 0) != sizeof(h)) | (h.count != slots)) {
+		fprintf(stderr, "ring: refused\n");
+		exit(1);
+	}
+	int fds[2];
+	memcpy(fds, CMSG_DATA(CMSG_FIRSTHDR(&msg)), sizeof(fds));
+	void *m = mmap(NULL, dccringsize(slots), PROT_READ | PROT_WRITE, MAP_SHARED, fds[0], 0);
+	if (m == MAP_FAILED) { perror("mmap"); exit(1); }
+	DCCRing ring(m, slots);
+	if (!ring.valid()) { fprintf(stderr, "ring: bad header\n"); exit(1); }
+
+	uint64_t one = 1, pos = 0;
+	bool wake = false;
+	uint64_t t1 = now();
+	for (int i=0; i<n; i++) {
+		while (!ring.push(command(i), pos, wake)) sched_yield();  //full, wavedccd is behind
+		if (wake && (write(fds[1], &one, sizeof(one)) != sizeof(one))) { perror("doorbell"); exit(1); }
+	}
+	while (!ring.complete(pos)) sched_yield();
+	uint64_t elapsed = now() - t1;
+
+	std::vector<uint64_t> latency;
+	for (int i=0; i<n/10; i++) {
+		uint64_t t = now();
+		while (!ring.push(command(i), pos, wake)) sched_yield();
+		if (wake && (write(fds[1], &one, sizeof(one)) != sizeof(one))) { perror("doorbell"); exit(1); }
+		while (!ring.complete(pos)) sched_yield();
+		latency.push_back(now() - t);
+	}
+	munmap(m, dccringsize(slots));
+	close(fds[0]);
+	close(fds[1]);
+	close(fd);
+	report("ring", elapsed, latency);
+}
+
+int main (int argc, char **argv)
+{
+	int port = 9034, binaryport = 0;
+	int opt;
+	while ((opt = getopt(argc, argv, "n:a:b:p:B:")) != -1) {
+		switch (opt) {
+			case 'n':
+				n = atoi(optarg);
+				break;
+			case 'a':
+				addresses = atoi(optarg);
+				break;
+			case 'b':
+				batch = atoi(optarg);
+				break;
+			case 'p':
+				port = atoi(optarg);
+				break;
+			case 'B':
+				binaryport = atoi(optarg);
+				break;
+		}
+	}
+	if ((optind >= argc) | (n < 10) | (addresses < 1) | (batch < 1) | (batch > DCCLOCAL_MAXRECORDS)) {
+		printf("usage: dcclocalbench [-n commands] [-a addresses] [-b batch] [-p port] [-B port] socketpath\n");
+		exit(1);
+	}
+
+	printf("%d commands, %d addresses, batches of %d\n", n, addresses, batch);
+	benchTCP(port);
+	if (binaryport) benchBinary(binaryport);
+	benchLocal(argv[optind]);
+	benchRing(argv[optind]);
+	exit(0);
+}
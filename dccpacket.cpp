@@ -17,6 +17,10 @@
 */
 
 
+#include <stdint.h>
+
+#include <algorithm>
+
 #include "dccpacket.h"
 
 DCCPacket::DCCPacket(int pinA, int pinB)
@@ -75,12 +79,12 @@ DCCPacket DCCPacket::makeBaselineIdlePacket(int pinA, int pinB)
 }
 
 
-DCCPacket DCCPacket::makeBaselineSpeedDirPacket(int pinA, int pinB, unsigned address, unsigned direction, unsigned  speed, bool headlight)
+DCCPacket DCCPacket::makeBaselineSpeedDirPacket(int pinA, int pinB, unsigned address, unsigned direction, int speed, bool headlight)
 {
 	DCCPacket p(pinA, pinB);
 
 	if (speed > 28) speed = 28;
-	if (speed < 0)  speed =  0;
+	if (speed < -1)  speed =  0;
 	if (direction > 1) direction = 1;
 	
 	//reset checksum accumulator
@@ -102,6 +106,7 @@ DCCPacket DCCPacket::makeBaselineSpeedDirPacket(int pinA, int pinB, unsigned add
 	p.addOne();
 	if (direction) p.addOne(); else p.addZero();
 	if (speed > 0) speed+=3; //gets around stop values, 10000 - 10001
+	else if (speed < 0) speed = 2; //emergency stop, 00001
 	if ((speed & 0b00000001)) p.addOne(); else p.addZero();
 	if ((speed & 0b00010000) >> 4) p.addOne(); else p.addZero();
 	if ((speed & 0b00001000) >> 3) p.addOne(); else p.addZero();
@@ -191,12 +196,15 @@ DCCPacket DCCPacket::makeBaselineBroadcastStopPacket(int pinA, int pinB, BASE_ST
 
 //Extended packet makers:
 
-DCCPacket DCCPacket::makeAdvancedSpeedDirPacket(int pinA, int pinB, unsigned address, unsigned direction, unsigned  speed, bool headlight)
+DCCPacket DCCPacket::makeAdvancedSpeedDirPacket(int pinA, int pinB, unsigned address, unsigned direction, int speed, bool headlight)
 {
 	DCCPacket p(pinA, pinB);
 
-	if (speed > 128) speed = 128;
-	if (speed < 0)  speed =  0;
+	if (speed > 126) speed = 126;
+	if (speed < -1)  speed =  0;
+	//step 0 is stop and 1 emergency stop, so speeds 1-126 are steps 2-127:
+	if (speed > 0) speed++;
+	else if (speed < 0) speed = 1;
 	if (direction > 1) direction = 1;
 	
 	//reset checksum accumulator
@@ -605,6 +613,60 @@ DCCPacket DCCPacket::makeServiceModeDirectVerifyBitPacket(int pinA, int pinB, in
 }
 
 
+//Packets for different outputs, e.g., several programming tracks, are merged by laying their 
+//pulses out on one time line; pulses that fall at the same time are combined into one with the
+//gpioOn/gpioOff masks or'd together.  The packets are first brought to the same length: each 
+//gets a trailing zero, stretched in the shorter ones to make up the difference.  A zero after 
+//the packet end bit is noise to a decoder waiting for the next preamble, and S-9.1 allows a 
+//stretched zero of up to 12ms, well more than the difference between any two packets.
+DCCPacket DCCPacket::merge(std::vector<DCCPacket> &packets)
+{
+	struct edge { int t; uint32_t on, off; };
+	std::vector<edge> edges;
+	DCCPacket m;
+	m.us = m.ones = m.zeros = 0;
+	if (packets.size() == 0) return m;
+	m.out1 = packets[0].out1;
+	m.out2 = packets[0].out2;
+
+	int longest = 0;
+	bool same = true;
+	for (unsigned i=0; i<packets.size(); i++) {
+		if ((i > 0) & (packets[i].us != packets[0].us)) same = false;
+		longest = std::max(longest, packets[i].us);
+	}
+
+	for (unsigned i=0; i<packets.size(); i++) {
+		DCCPacket p(packets[i]);
+		if (!same) p.addStretchedZero(longest + 200 - p.us);
+		int t = 0;
+		for (unsigned j=0; j<p.pulsetrain.size(); j++) {
+			edges.push_back(edge{ t, p.pulsetrain[j].gpioOn, p.pulsetrain[j].gpioOff });
+			t += p.pulsetrain[j].usDelay;
+		}
+		m.us = t;
+	}
+	std::stable_sort(edges.begin(), edges.end(), [](const edge &a, const edge &b) { return a.t < b.t; });
+
+	for (unsigned i=0; i<edges.size(); i++) {
+		if ((m.pulsetrain.size() > 0) && (edges[i].t == edges[i-1].t)) {
+			m.pulsetrain.back().gpioOn |= edges[i].on;
+			m.pulsetrain.back().gpioOff |= edges[i].off;
+			continue;
+		}
+		if (m.pulsetrain.size() > 0) m.pulsetrain.back().usDelay = edges[i].t - edges[i-1].t;
+		gpioPulse_t g;
+		g.gpioOn = edges[i].on;
+		g.gpioOff = edges[i].off;
+		g.usDelay = 0;
+		m.pulsetrain.push_back(g);
+	}
+	m.pulsetrain.back().usDelay = m.us - edges.back().t;
+	m.pulsestring = packets[0].pulsestring;
+	return m;
+}
+
+
 #define ONE 58
 #define ZERO 100
 
@@ -648,6 +710,26 @@ void DCCPacket::addZero()
 
 
 
+void DCCPacket::addStretchedZero(int micros)
+{
+	gpioPulse_t p[2];
+
+	p[0].gpioOn  = (1<<out1);
+	p[0].gpioOff = (1<<out2);
+	p[0].usDelay = micros / 2;
+	p[1].gpioOn  = (1<<out2);
+	p[1].gpioOff = (1<<out1);
+	p[1].usDelay = micros - micros / 2;
+	pulsetrain.push_back(p[0]);
+	pulsetrain.push_back(p[1]);
+	pulsestring.append("0");
+	us += micros;
+	bt = (bt << 1);
+	zeros++;
+}
+
+
+
 //Checksum accumulators and adders;
 
 void DCCPacket::resetCK()
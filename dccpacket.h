@@ -49,12 +49,14 @@ public:
 	
 	//Baseline packets:
 	static DCCPacket makeBaselineIdlePacket(int pinA, int pinB);
-	static DCCPacket makeBaselineSpeedDirPacket(int pinA, int pinB, unsigned address, unsigned direction, unsigned  speed, bool headlight);
+	//speed 0-28, or -1 for emergency stop:
+	static DCCPacket makeBaselineSpeedDirPacket(int pinA, int pinB, unsigned address, unsigned direction, int speed, bool headlight);
 	static DCCPacket makeBaselineResetPacket(int pinA, int pinB);
 	static DCCPacket makeBaselineBroadcastStopPacket(int pinA, int pinB, BASE_STOP stopcommand);
 	
 	//Extended packets:
-	static DCCPacket makeAdvancedSpeedDirPacket(int pinA, int pinB, unsigned address, unsigned direction, unsigned  speed, bool headlight);
+	//speed 0-126, or -1 for emergency stop:
+	static DCCPacket makeAdvancedSpeedDirPacket(int pinA, int pinB, unsigned address, unsigned direction, int speed, bool headlight);
 	static DCCPacket makeAdvancedFunctionGroupOnePacket(int pinA, int pinB, unsigned address, unsigned value);
 	static DCCPacket makeAdvancedFunctionGroupTwoPacket(int pinA, int pinB, unsigned address, unsigned value);
 	static DCCPacket makeAdvancedFunctionGroupPacket(int pinA, int pinB, unsigned address, unsigned value);
@@ -66,9 +68,13 @@ public:
 	static DCCPacket makeServiceModeDirectVerifyBitPacket(int pinA, int pinB, int CV, char bit, char value);
 	static DCCPacket makeWriteCVToAddressPacket(int pinA, int pinB, int address, int CV, char value);
 	
+	//Merges packets for different outputs into one pulse train, to send them at the same time:
+	static DCCPacket merge(std::vector<DCCPacket> &packets);
+	
 
 	void addOne();  //adds a DCC one-pulse to the pulsetrain
 	void addZero(); //adds a DCC zero-pulse to the pulsetrain
+	void addStretchedZero(int micros); //adds a DCC zero-pulse of micros total, >= 200us, to the pulsetrain
 	
 	void resetCK();  //call this at the beginning of a packet assembly
 	void resetBT();  //call this at the beginning of a byte assembly
@@ -0,0 +1,277 @@
+/*
+    This file is part of wavedcc,
+    Copyright (C) 2021 Glenn Butcher.
+
+    wavedcc is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    wavedcc is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with wavedcc.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+//Service mode and overload protection simulator: runs the ack detector (ackdetector.h) and the 
+//overload protection (protection.h) against the simulated sensor and decoder (simsensor.h), on a
+//virtual clock, so their behavior can be checked on any Linux box, without pigpio or a track.
+//
+//The reads walk the bits and verify the byte as the engine's readCV does, each verify an S-9.2.3
+//3 reset/5 packet/6 reset chain sampled every sample interval, with the detector windowed as the
+//engine's ackChain does.  Each read is compared to the decoder's CV, and the exit status is 1 if
+//any differ; a CV the decoder doesn't have is expected to fail the read.  With a trace, the current
+//is replayed from it instead, and the decoder's acks are whatever the trace holds.
+//
+//The protection run samples the main track at the sample interval for its length, with the short
+//circuits added to the current while the track has power, and reports the trips, restores and
+//lockouts as they happen.
+//
+//usage: dccsim [-c cvs] [-r cvs] [-t tracefile] [-q ma] [-n ma] [-a ma] [-w ms] [-i ms] [-s at,ms,ma]... [-p ms]
+//	-c: the decoder's CVs, cv:value,..., default 1:3,7:1,8:13,29:6
+//	-r: the CVs to read, cv,..., default the decoder's
+//	-t: replays the trace file, lines of "microseconds current [voltage]", instead of synthesizing
+//	-q, -n, -a, -w: synthesized quiescent current, noise standard deviation and ack milliamps, and
+//	    ack width milliseconds, default 20.0, 2.0, 70.0 and 6
+//	-i: sample interval milliseconds, default 2.0, as the 'sampleinterval' property
+//	-s: a short circuit, ma milliamps from at milliseconds into the protection run for ms 
+//	    milliseconds; repeatable
+//	-p: milliseconds of the protection run, default 2000 past the end of the last short; 0 for none
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include "simsensor.h"
+#include "ackdetector.h"
+#include "protection.h"
+
+//the engine's defaults, as in wavedcc.conf:
+float ack_limit = 60.0;
+float ack_sigma = 3.0;
+int ack_min = 5;
+int ack_window = 20;
+float ack_confidence = 0.5;
+int sample_count = 10;
+
+SimulatedSensor *sensor;
+Baseline tracker;
+uint64_t clock_us = 1000000;	//the virtual clock, microseconds
+uint64_t interval = 2000;	//sample interval, microseconds
+unsigned chains = 0;
+float confidence;		//of the last chain
+
+//the bits of a packet, as DCCPacket::getPulseString() has them, with the error detection byte
+//appended:
+std::string packetBits(std::vector<uint8_t> bytes, int preamble)
+{
+	uint8_t ck = 0;
+	for (unsigned i=0; i<bytes.size(); i++) ck ^= bytes[i];
+	bytes.push_back(ck);
+	std::string bits(preamble, '1');
+	for (unsigned i=0; i<bytes.size(); i++) {
+		bits += " 0 ";
+		for (int b=7; b>=0; b--) bits += (bytes[i] >> b) & 1 ? '1' : '0';
+	}
+	return bits + " 1 ";
+}
+
+//DCC one and zero bits, 116us and 200us:
+int packetMicros(const std::string &bits)
+{
+	int us = 0;
+	for (unsigned i=0; i<bits.size(); i++) {
+		if (bits[i] == '1') us += 116;
+		else if (bits[i] == '0') us += 200;
+	}
+	return us;
+}
+
+const std::string resetbits = packetBits({0x00, 0x00}, 12);
+
+//samples the current from the virtual clock up to end, to the detector if there is one, stopping
+//when it has an outcome:
+void sampleTo(uint64_t end, std::vector<float> &currents, AckDetector *detector = NULL)
+{
+	for (; clock_us < end; clock_us += interval) {
+		float c = sensor->current(clock_us);
+		currents.push_back(c);
+		if (detector && detector->sample(c, clock_us)) break;
+	}
+}
+
+//the S-9.2.3 power-up, 20 resets, with quiescent from the last sample_count samples:
+void calibrate()
+{
+	std::vector<float> currents;
+	sampleTo(clock_us + 20 * (uint64_t) packetMicros(resetbits), currents);
+	tracker.clear();
+	for (int i=(int) currents.size()-sample_count; i<(int) currents.size(); i++)
+		if (i >= 0) tracker.add(currents[i]);
+}
+
+bool ackChain(const std::string &bits)
+{
+	std::vector<float> currents;
+	uint64_t rmicros = packetMicros(resetbits), pmicros = packetMicros(bits);
+	uint64_t start = clock_us;
+	sensor->transmit(bits, pmicros, start + 3*rmicros, 5);
+	ackparams params = { ack_limit, ack_sigma, 1000 * ack_min };
+	AckDetector detector(tracker, params,
+		start + rmicros,
+		start + 3*rmicros + 2*pmicros, 
+		start + 3*rmicros + 5*pmicros + 1000*ack_window
+	);
+	sampleTo(start + 9*rmicros + 5*pmicros, currents, &detector);
+	chains++;
+	confidence = detector.confidence();
+	return detector.ack();
+}
+
+//service mode direct, S-9.2.3:
+bool verifyBit(unsigned cv, unsigned bit, unsigned val)
+{
+	cv--;
+	return ackChain(packetBits({(uint8_t) (0x78 | ((cv >> 8) & 0x03)), (uint8_t) (cv & 0xff), (uint8_t) (0xe0 | (val << 3) | bit)}, 20));
+}
+
+bool verifyByte(unsigned cv, unsigned val)
+{
+	cv--;
+	return ackChain(packetBits({(uint8_t) (0x74 | ((cv >> 8) & 0x03)), (uint8_t) (cv & 0xff), (uint8_t) val}, 20));
+}
+
+//the engine's readCV, without the speculation:
+int readCV(unsigned cv)
+{
+	for (int attempt=1; attempt<=3; attempt++) {
+		int val;
+		if (verifyBit(cv, 0, 1)) val = 1;
+		else if (verifyBit(cv, 0, 0)) val = 0;
+		else continue;
+		for (unsigned i=1; i<8; i++) {
+			bool one = verifyBit(cv, i, 1);
+			if (confidence < ack_confidence) {
+				float c = confidence;
+				bool again = verifyBit(cv, i, 1);
+				if (confidence > c) one = again;
+			}
+			if (one) val |= 1<<i;
+		}
+		if (verifyByte(cv, val)) return val;
+	}
+	return -1;
+}
+
+struct shortcircuit {
+	int at, ms;
+	float ma;
+};
+
+//runs the protection for ms milliseconds of samples, the shorts drawing current only while the
+//track has power:
+void protectRun(int ms, std::vector<shortcircuit> &shorts)
+{
+	static const char *states[] = { "off", "on", "tripped", "locked out" };
+	protectparams params = { 3000.0, 3, 500, 8000, 2000, 3 };
+	Protection protection(params);
+	OverloadCounter overloads;
+	bool power = true;
+	uint64_t start = clock_us;
+	protection.arm(true);
+	for (; clock_us < start + (uint64_t) ms * 1000; clock_us += interval) {
+		int t = (clock_us - start) / 1000;
+		float c = sensor->current(clock_us);
+		for (unsigned i=0; i<shorts.size(); i++)
+			if (power & (t >= shorts[i].at) & (t < shorts[i].at + shorts[i].ms)) c += shorts[i].ma;
+		if (overloads.sample(c, clock_us, params) & (protection.state() == PROTECT_ON)) {
+			power = false;
+			protection.trip(clock_us, clock_us - overloads.detected(), false, [&power]() { power = false; });
+			printf("%6dms: %04.2fma, %s, backoff %dms\n", t, c, states[protection.state()], protection.statistics().backoff);
+		}
+		if (protection.restore(clock_us, false, [&power]() { power = true; }))
+			printf("%6dms: restored\n", t);
+	}
+	protectstatistics s = protection.statistics();
+	printf("protection: %s, trips %d, restores %d, lockouts %d\n", states[protection.state()], s.trips, s.restores, s.lockouts);
+}
+
+int main (int argc, char **argv)
+{
+	std::string cvs = "1:3,7:1,8:13,29:6", reads, trace;
+	float quiescent = 20.0, noise = 2.0, ack = 70.0;
+	int width = 6, run = -1;
+	std::vector<shortcircuit> shorts;
+	int opt;
+	while ((opt = getopt(argc, argv, "c:r:t:q:n:a:w:i:s:p:")) != -1) {
+		switch (opt) {
+			case 'c': cvs = optarg; break;
+			case 'r': reads = optarg; break;
+			case 't': trace = optarg; break;
+			case 'q': quiescent = atof(optarg); break;
+			case 'n': noise = atof(optarg); break;
+			case 'a': ack = atof(optarg); break;
+			case 'w': width = atoi(optarg); break;
+			case 'i': interval = atof(optarg) * 1000; break;
+			case 'p': run = atoi(optarg); break;
+			case 's': {
+				shortcircuit s;
+				if (sscanf(optarg, "%d,%d,%f", &s.at, &s.ms, &s.ma) != 3) {
+					std::cout << "dccsim: -s is at,ms,ma" << std::endl;
+					exit(1);
+				}
+				shorts.push_back(s);
+				break;
+			}
+			default:
+				std::cout << "usage: dccsim [-c cvs] [-r cvs] [-t tracefile] [-q ma] [-n ma] [-a ma] [-w ms] [-i ms] [-s at,ms,ma]... [-p ms]" << std::endl;
+				exit(1);
+		}
+	}
+	if (interval == 0) interval = 1;
+
+	sensor = new SimulatedSensor(quiescent, noise, ack, width);
+	if ((trace != "") && !sensor->load(trace)) {
+		std::cout << "dccsim: trace " << trace << " not loaded" << std::endl;
+		exit(1);
+	}
+	sensor->decoder.configure(cvs);
+
+	std::vector<unsigned> cvlist;
+	std::stringstream l(reads != "" ? reads : cvs);
+	std::string item;
+	while (std::getline(l, item, ',')) cvlist.push_back(atoi(item.c_str()));
+
+	int mismatches = 0;
+	if (cvlist.size() > 0) {
+		calibrate();
+		printf("quiescent %04.2fma, noise %04.2fma\n", tracker.median(), tracker.noise());
+	}
+	for (unsigned i=0; i<cvlist.size(); i++) {
+		unsigned before = chains;
+		uint64_t started = clock_us;
+		int expected = sensor->decoder.get(cvlist[i]);
+		int val = readCV(cvlist[i]);
+		printf("CV%d: read %d, decoder %d, %d chains, %dms%s\n", cvlist[i], val, expected, chains - before, 
+			(int) ((clock_us - started) / 1000), (val == expected) | (trace != "") ? "" : ", MISMATCH");
+		if (val != expected) mismatches++;
+	}
+
+	if (run < 0) {
+		run = 0;
+		for (unsigned i=0; i<shorts.size(); i++) run = std::max(run, shorts[i].at + shorts[i].ms + 2000);
+	}
+	if (run > 0) protectRun(run, shorts);
+
+	return (mismatches > 0) & (trace == "") ? 1 : 0;
+}
@@ -0,0 +1,66 @@
+/*
+    This file is part of wavedcc,
+    Copyright (C) 2021 Glenn Butcher.
+
+    wavedcc is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    wavedcc is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with wavedcc.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __DCCTOKENS_H__
+#define __DCCTOKENS_H__
+
+#include <string_view>
+#include <charconv>
+
+#define CMDTOKENS_MAX 16
+
+//A DCC++ command split into its whitespace-separated fields, each a string_view into the command
+//text, so tokenizing copies and allocates nothing.  tok[0] is the opcode.
+struct cmdtokens {
+	std::string_view tok[CMDTOKENS_MAX];
+	unsigned n;
+};
+
+//splits cmd into c, skipping the '<' and '>' delimiters and whitespace.  Returns false for an
+//empty command, or one with more than CMDTOKENS_MAX fields:
+inline bool tokenize(std::string_view cmd, cmdtokens &c)
+{
+	c.n = 0;
+	size_t i = 0, len = cmd.size();
+	while (i < len) {
+		while ((i < len) && ((cmd[i] == '<') | (cmd[i] == '>') | (cmd[i] == ' ') | (cmd[i] == '\t') | (cmd[i] == '\r') | (cmd[i] == '\n'))) i++;
+		if (i == len) break;
+		size_t start = i;
+		while ((i < len) && !((cmd[i] == '<') | (cmd[i] == '>') | (cmd[i] == ' ') | (cmd[i] == '\t') | (cmd[i] == '\r') | (cmd[i] == '\n'))) i++;
+		if (c.n == CMDTOKENS_MAX) return false;
+		c.tok[c.n++] = cmd.substr(start, i - start);
+	}
+	return c.n > 0;
+}
+
+//parses the whole of s as a decimal integer; unlike atoi(), trailing junk is an error:
+inline bool field(std::string_view s, int &v)
+{
+	const char *end = s.data() + s.size();
+	std::from_chars_result r = std::from_chars(s.data(), end, v);
+	return (r.ec == std::errc()) & (r.ptr == end);
+}
+
+inline bool field(std::string_view s, uint32_t &v)
+{
+	const char *end = s.data() + s.size();
+	std::from_chars_result r = std::from_chars(s.data(), end, v);
+	return (r.ec == std::errc()) & (r.ptr == end);
+}
+
+#endif
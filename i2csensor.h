@@ -0,0 +1,285 @@
+
+
+/*
+	ic2_read(), ic2_write(), register_read(), register_write() from:
+	https://github.com/ZigFisher/Glutinium/blob/master/i2c-telemetry/src/ina219.c
+	GPL 2.0 License
+	
+	Modified to use pigpio I2C routines.
+*/
+
+#ifndef __I2CSENSOR_H__
+#define __I2CSENSOR_H__
+
+#ifdef USE_PIGPIOD_IF
+#include <pigpiod_if2.h> 
+#else
+#include <pigpio.h>
+#endif
+
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <linux/i2c.h>
+#include <linux/i2c-dev.h>
+
+#include <string>
+
+#include "pigpio_errors.h"
+#include "currentsensor.h"
+
+//Base of the I2C current sensors, the register access on top of either pigpio or the kernel
+//I2C driver.  The sensors all have 16-bit big-endian registers behind a pointer register.
+//
+//Register pointer caching: the sensor keeps the pointer register from one transaction to the 
+//next, so reading the same register again is just the two-byte read.  Sampling only the current
+//register, then, is one I2C transaction per sample.
+//
+//Kernel backend: with a device, e.g., /dev/i2c-1, configure() talks to the sensor through the 
+//kernel I2C driver instead of pigpio.  In a pigpiod build that takes the socket round trip to 
+//pigpiod out of every register access.  A register read is one ioctl, an I2C_RDWR combined 
+//pointer write/read, or just the read if the pointer is already there.  Adapters without plain 
+//I2C support, e.g., the i2c-stub test module, get SMBus word transfers instead, which are also
+//one ioctl per access.
+class I2CSensor : public CurrentSensor
+{
+public:
+	I2CSensor()
+	{
+		pointer = -1;
+		dev_fd = -1;
+		dev_smbus = false;
+		i2c_handle = -1;
+	}
+
+	//opens the sensor at address, through the kernel I2C device if one is given and usable, else
+	//through pigpio on bus 1, and writes the sensor's configuration:
+#ifdef USE_PIGPIOD_IF
+	void configure(int pigpioid, std::string device, int address)
+	{
+		pigpio_id = pigpioid;
+		i2c_bus = 1;
+		i2c_address = address;
+		if (device.empty() || !open_dev(device, address))
+			if ((i2c_handle = i2c_open(pigpio_id, i2c_bus, i2c_address, 0)) < 0) err(i2c_handle, "ic2_open");
+		setup();
+	}
+	
+	int deconfigure() 
+	{
+		if (dev_fd >= 0) return close_dev();
+		return i2c_close(pigpio_id, i2c_handle);
+	}
+#else
+	void configure(std::string device, int address)
+	{
+		i2c_bus = 1;
+		i2c_address = address;
+		if (device.empty() || !open_dev(device, address))
+			if ((i2c_handle = i2cOpen(i2c_bus, i2c_address, 0)) < 0) err(i2c_handle, "ic2Open");
+		setup();
+	}
+	
+	int deconfigure()
+	{
+		if (dev_fd >= 0) return close_dev();
+		return i2cClose(i2c_handle);
+	}
+#endif
+
+protected:
+	//writes the sensor's configuration registers:
+	virtual void setup() = 0;
+
+	void err(int error, const char * msg)
+	{
+		err_rec r = pigpioError(error);
+		printf("%s: %s - %s\n", msg, r.name.c_str(), r.description.c_str());
+	}
+
+	int i2c_read( unsigned char *buf, int len )
+	{
+		int rc = 0;
+#ifdef USE_PIGPIOD_IF
+		if (rc = i2c_read_device(pigpio_id, i2c_handle, (char *) buf, len) <= 0 )
+#else
+		if (rc = i2cReadDevice(i2c_handle, (char *) buf, len) <= 0 ) 
+#endif
+		{
+			err(rc, "I2C read");
+			rc = -1;
+		}
+
+		return rc;
+	}
+
+
+	int i2c_write( unsigned char *buf, int len )
+	{
+		int rc = 0;
+
+#ifdef USE_PIGPIOD_IF
+		if (rc = i2c_write_device(pigpio_id, i2c_handle, (char *) buf, len) != 0 )
+#else
+		if (rc = i2cWriteDevice(i2c_handle, (char *) buf, len) != 0)
+#endif
+		{
+			err(rc, "I2C write");
+			rc = -1;
+		}
+
+		return rc;
+	}
+
+	//the pointer write is skipped if the pointer is already at reg:
+	int register_read( unsigned char reg, unsigned short *data )
+	{
+		int rc = -1;
+		unsigned char bite[ 4 ];
+
+		if ( dev_fd >= 0 ) return dev_register_read( reg, data );
+
+		if ( pointer != reg )
+		{
+			bite[ 0 ] = reg;
+			if ( i2c_write( bite, 1 ) != 0 )
+			{
+				pointer = -1;
+				return rc;
+			}
+			pointer = reg;
+		}
+		if ( i2c_read( bite, 2 ) == 0 )
+		{
+			*data = ( bite[ 0 ] << 8 ) | bite[ 1 ];
+			rc = 0;
+		}
+		else pointer = -1;
+
+		return rc;
+	}
+
+	int register_write( unsigned char reg, unsigned short data )
+	{
+		int rc = -1;
+		unsigned char bite[ 4 ];
+
+		if ( dev_fd >= 0 ) return dev_register_write( reg, data );
+
+		bite[ 0 ] = reg;
+		bite[ 1 ] = ( data >> 8 ) & 0xFF;
+		bite[ 2 ] = ( data & 0xFF );
+
+		pointer = reg;  //a register write leaves the pointer at the register
+		if ( i2c_write( bite, 3 ) == 0 )
+		{
+			rc = 0;
+		}
+		else pointer = -1;
+
+		return rc;
+	}
+
+private:
+	//returns false if the device can't be opened or doesn't support either transfer type:
+	bool open_dev(std::string device, int address)
+	{
+		unsigned long funcs;
+		dev_fd = open(device.c_str(), O_RDWR | O_CLOEXEC);
+		if (dev_fd < 0) {
+			printf("%s: can't open, using pigpio for the sensor at 0x%02x\n", device.c_str(), address);
+			return false;
+		}
+		if (ioctl(dev_fd, I2C_FUNCS, &funcs) < 0) funcs = 0;
+		dev_smbus = !(funcs & I2C_FUNC_I2C);
+		if (dev_smbus) {
+			if (((funcs & I2C_FUNC_SMBUS_WORD_DATA) != I2C_FUNC_SMBUS_WORD_DATA) | (ioctl(dev_fd, I2C_SLAVE, address) < 0)) {
+				printf("%s: no SMBus word transfers to 0x%02x, using pigpio\n", device.c_str(), address);
+				::close(dev_fd);
+				dev_fd = -1;
+				return false;
+			}
+		}
+		return true;
+	}
+
+	int close_dev()
+	{
+		int rc = ::close(dev_fd);
+		dev_fd = -1;
+		return rc;
+	}
+
+	//SMBus words are little-endian, the sensor registers big-endian:
+	int dev_register_read( unsigned char reg, unsigned short *data )
+	{
+		unsigned char bite[ 4 ];
+		if ( dev_smbus )
+		{
+			union i2c_smbus_data d;
+			struct i2c_smbus_ioctl_data x = { I2C_SMBUS_READ, reg, I2C_SMBUS_WORD_DATA, &d };
+			if ( ioctl( dev_fd, I2C_SMBUS, &x ) < 0 ) return -1;
+			*data = ( ( d.word & 0xFF ) << 8 ) | ( d.word >> 8 );
+			return 0;
+		}
+
+		struct i2c_msg msgs[ 2 ];
+		int n = 0;
+		if ( pointer != reg )
+		{
+			bite[ 2 ] = reg;
+			msgs[ n ].addr = i2c_address;
+			msgs[ n ].flags = 0;
+			msgs[ n ].len = 1;
+			msgs[ n ].buf = &bite[ 2 ];
+			n++;
+		}
+		msgs[ n ].addr = i2c_address;
+		msgs[ n ].flags = I2C_M_RD;
+		msgs[ n ].len = 2;
+		msgs[ n ].buf = bite;
+		n++;
+		struct i2c_rdwr_ioctl_data x = { msgs, (unsigned) n };
+		if ( ioctl( dev_fd, I2C_RDWR, &x ) != n )
+		{
+			pointer = -1;
+			return -1;
+		}
+		pointer = reg;
+		*data = ( bite[ 0 ] << 8 ) | bite[ 1 ];
+		return 0;
+	}
+
+	int dev_register_write( unsigned char reg, unsigned short data )
+	{
+		unsigned char bite[ 4 ];
+		if ( dev_smbus )
+		{
+			union i2c_smbus_data d;
+			d.word = ( ( data & 0xFF ) << 8 ) | ( data >> 8 );
+			struct i2c_smbus_ioctl_data x = { I2C_SMBUS_WRITE, reg, I2C_SMBUS_WORD_DATA, &d };
+			return ( ioctl( dev_fd, I2C_SMBUS, &x ) < 0 ) ? -1 : 0;
+		}
+
+		bite[ 0 ] = reg;
+		bite[ 1 ] = ( data >> 8 ) & 0xFF;
+		bite[ 2 ] = ( data & 0xFF );
+		struct i2c_msg msg = { (unsigned short) i2c_address, 0, 3, bite };
+		struct i2c_rdwr_ioctl_data x = { &msg, 1 };
+		if ( ioctl( dev_fd, I2C_RDWR, &x ) != 1 )
+		{
+			pointer = -1;
+			return -1;
+		}
+		pointer = reg;
+		return 0;
+	}
+
+	int i2c_bus, i2c_address, i2c_handle, pigpio_id;
+	int pointer;	//register the pointer is at, -1 if not known
+	int dev_fd;	//kernel I2C device, -1 if pigpio is used
+	bool dev_smbus;	//the kernel device only supports SMBus transfers
+};
+
+#endif
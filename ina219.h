@@ -1,21 +1,17 @@
 
 
 /*
-	ic2_read(), ic2_write(), register_read(), register_write(), get_*() and associated #defines from:
+	get_*() and associated #defines from:
 	https://github.com/ZigFisher/Glutinium/blob/master/i2c-telemetry/src/ina219.c
 	GPL 2.0 License
 	
 	Modified to use pigpio I2C routines.
 */
 
-#ifdef USE_PIGPIOD_IF
-#include <pigpiod_if2.h> 
-#else
-#include <pigpio.h>
-#endif
+#ifndef __INA219_H__
+#define __INA219_H__
 
-#include <stdio.h>
-#include "pigpio_errors.h"
+#include "i2csensor.h"
 
 #define CONFIG_REG          0
 #define SHUNT_REG           1
@@ -24,44 +20,34 @@
 #define CURRENT_REG         4
 #define CALIBRATION_REG     5
 
-class INA219
+#define CNVR                0x0002	//conversion ready, bus voltage register
+
+//TI INA219.  Sampling only the current register, with the pointer cached, is one I2C transaction
+//per sample instead of the four of get_voltage() and get_current() together.
+//
+//The ADC averaging is set with set_averaging() before configure(); averaging n samples takes
+//about n * 532us per conversion, n=1-128, and in continuous mode the shunt and bus conversions
+//alternate, so a new reading is available every shunt + bus conversion time.
+class INA219 : public I2CSensor
 {
 public:
-	INA219() { }
-
-#ifdef USE_PIGPIOD_IF
-	void configure (int pigpioid)
-	{
-		i2c_bus = 1;
-		i2c_address=0x40;
-		pigpio_id = pigpioid;
-		if ((i2c_handle = i2c_open(pigpio_id, i2c_bus, i2c_address, 0)) < 0) err(i2c_handle, "ic2_open");
-		//register_write( CONFIG_REG, 0x1eef);		//16V
-		register_write( CONFIG_REG, 0x3eef); 		//32V
-		register_write( CALIBRATION_REG, 0x8332);
-	}
-	
-	int deconfigure() 
-	{
-		return i2c_close(pigpio_id, i2c_handle);
+	INA219() 
+	{ 
+		config = 0x3eef;  //32V, /8 gain, 32 sample averaging on both ADCs, continuous
 	}
-#else
-	void configure()
+
+	//sets the number of samples averaged by the shunt (current) and bus (voltage) ADCs, 
+	//1,2,4,...128; other values are rounded down to one of those:
+	void set_averaging(int shunt, int bus)
 	{
-		i2c_bus = 1;
-		i2c_address=0x40;
-		if (i2c_handle = i2cOpen(i2c_bus, i2c_address, 0) < 0) err(i2c_handle, "ic2Open");
-		//register_write( CONFIG_REG, 0x1eef);		//16V
-		register_write( CONFIG_REG, 0x3eef); 		//32V
-		register_write( CALIBRATION_REG, 0x8332);
+		config = (config & 0xf807) | (adc_bits(bus) << 7) | (adc_bits(shunt) << 3);
 	}
-	
-	int deconfigure()
+
+	//microseconds between readings with the configured averaging:
+	int conversion_micros()
 	{
-		return i2cClose(i2c_handle);
+		return adc_micros((config >> 3) & 0x0f) + adc_micros((config >> 7) & 0x0f);
 	}
-#endif
-
 
 	float get_voltage()
 	{
@@ -85,85 +71,51 @@ public:
 		return (float)current / 10;
 	}
 
-
-	void err(int error, const char * msg)
+	//conversion-ready polling: returns false if no conversion has completed since the last call,
+	//else reads the new current and voltage, and clears the flag by reading the power register:
+	bool get_current_ready(float &current, float &voltage)
 	{
-		err_rec r = pigpioError(error);
-		printf("%s: %s - %s\n", msg, r.name.c_str(), r.description.c_str());
+		short busv, c;
+		unsigned short power;
+		if ( register_read( BUS_REG, (unsigned short*)&busv ) != 0 ) return false;
+		if ( !(busv & CNVR) ) return false;
+		if ( register_read( CURRENT_REG, (unsigned short*)&c ) != 0 ) return false;
+		register_read( POWER_REG, &power );
+		voltage = ( float )( ( busv & 0xFFF8 ) >> 1 );
+		current = (float)c / 10;
+		return true;
 	}
 
-	int i2c_read( unsigned char *buf, int len )
+	std::string name()
 	{
-		int rc = 0;
-#ifdef USE_PIGPIOD_IF
-		if (rc = i2c_read_device(pigpio_id, i2c_handle, (char *) buf, len) <= 0 )
-#else
-		if (rc = i2cReadDevice(i2c_handle, (char *) buf, len) <= 0 ) 
-#endif
-		{
-			err(rc, "I2C read");
-			rc = -1;
-		}
-
-		return rc;
+		return "ina219";
 	}
 
-
-	int i2c_write( unsigned char *buf, int len )
+protected:
+	void setup()
 	{
-		int rc = 0;
-
-#ifdef USE_PIGPIOD_IF
-		if (rc = i2c_write_device(pigpio_id, i2c_handle, (char *) buf, len) != 0 )
-#else
-		if (rc = i2cWriteDevice(i2c_handle, (char *) buf, len) != 0)
-#endif
-		{
-			err(rc, "I2C write");
-			rc = -1;
-		}
-
-		return rc;
+		//register_write( CONFIG_REG, 0x1eef);		//16V
+		register_write( CONFIG_REG, config); 		//32V
+		register_write( CALIBRATION_REG, 0x8332);
 	}
 
-	int register_read( unsigned char reg, unsigned short *data )
+private:
+	//1000 is 12 bit, no averaging, and 1001-1111 average 2-128 samples:
+	static unsigned short adc_bits(int samples)
 	{
-		int rc = -1;
-		unsigned char bite[ 4 ];
-
-		bite[ 0 ] = reg;
-		if ( i2c_write( bite, 1 ) == 0 )
-		{
-			if ( i2c_read( bite, 2 ) == 0 )
-			{
-				*data = ( bite[ 0 ] << 8 ) | bite[ 1 ];
-				rc = 0;
-			}
-		}
-
-		return rc;
+		unsigned short k = 0;
+		while ((samples >>= 1) > 0 && k < 7) k++;
+		return 0x8 | k;
 	}
 
-	int register_write( unsigned char reg, unsigned short data )
+	static int adc_micros(unsigned short bits)
 	{
-		int rc = -1;
-		unsigned char bite[ 4 ];
-
-		bite[ 0 ] = reg;
-		bite[ 1 ] = ( data >> 8 ) & 0xFF;
-		bite[ 2 ] = ( data & 0xFF );
-
-		if ( i2c_write( bite, 3 ) == 0 )
-		{
-			rc = 0;
-		}
-
-		return rc;
+		static const int resolution[4] = { 84, 148, 276, 532 };  //0000-0011, 9-12 bit
+		if (bits < 0x8) return resolution[bits];
+		return 532 << (bits & 0x7);
 	}
 
-private:
-	int i2c_bus, i2c_address, i2c_handle, pigpio_id;
-	
+	unsigned short config;
 };
 
-
+#endif
@@ -0,0 +1,113 @@
+/*
+    This file is part of wavedcc,
+    Copyright (C) 2021 Glenn Butcher.
+
+    wavedcc is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    wavedcc is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with wavedcc.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __INA260_H__
+#define __INA260_H__
+
+#include "i2csensor.h"
+
+#define INA260_CONFIG_REG	0x00
+#define INA260_CURRENT_REG	0x01
+#define INA260_BUS_REG		0x02
+#define INA260_POWER_REG	0x03
+#define INA260_MASK_REG		0x06
+#define INA260_ALERT_REG	0x07
+
+#define INA260_CVRF		0x0008	//conversion ready, mask/enable register
+#define INA260_OCL		0x8000	//alert on over current limit, mask/enable register
+
+//TI INA260.  The shunt is integrated, so there's no calibration; the current register LSB is 
+//1.25ma, the bus voltage 1.25mv.  One averaging setting covers both conversions, and the 
+//conversion-ready flag is in the mask/enable register, cleared by reading it.
+class INA260 : public I2CSensor
+{
+public:
+	INA260()
+	{
+		config = 0x6127;  //1 sample, 1.1ms conversions, continuous shunt and bus
+	}
+
+	//sets the number of samples averaged, 1,4,16,64,128,256,512 or 1024, rounded down to one of 
+	//those; the voltage averaging is the same as the current's:
+	void set_averaging(int current, int voltage)
+	{
+		int k = 0;
+		while ((k < 7) && (averages(k+1) <= current)) k++;
+		config = (config & 0xf1ff) | (k << 9);
+	}
+
+	int conversion_micros()
+	{
+		return averages((config >> 9) & 0x7) * 2 * 1100;
+	}
+
+	float get_current()
+	{
+		short current;
+		if ( register_read( INA260_CURRENT_REG, (unsigned short*)&current ) != 0 ) return -1;
+		return (float) current * 1.25;
+	}
+
+	float get_voltage()
+	{
+		unsigned short busv;
+		if ( register_read( INA260_BUS_REG, &busv ) != 0 ) return -1;
+		return (float) busv * 1.25;
+	}
+
+	bool get_current_ready(float &current, float &voltage)
+	{
+		unsigned short mask;
+		if ( register_read( INA260_MASK_REG, &mask ) != 0 ) return false;
+		if ( !(mask & INA260_CVRF) ) return false;
+		voltage = get_voltage();
+		current = get_current();
+		return true;
+	}
+
+	//asserts the active-low ALERT pin while a conversion is over ma, transparent, not latched, so
+	//the pin's falling edge marks each overload:
+	bool set_alert(float ma)
+	{
+		if ( register_write( INA260_ALERT_REG, (unsigned short) (ma / 1.25) ) != 0 ) return false;
+		if ( register_write( INA260_MASK_REG, INA260_OCL ) != 0 ) return false;
+		return true;
+	}
+
+	std::string name()
+	{
+		return "ina260";
+	}
+
+protected:
+	void setup()
+	{
+		register_write( INA260_CONFIG_REG, config );
+	}
+
+private:
+	static int averages(int k)
+	{
+		static const int a[8] = { 1, 4, 16, 64, 128, 256, 512, 1024 };
+		return a[k];
+	}
+
+	unsigned short config;
+};
+
+#endif
@@ -0,0 +1,121 @@
+/*
+    This file is part of wavedcc,
+    Copyright (C) 2021 Glenn Butcher.
+
+    wavedcc is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    wavedcc is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with wavedcc.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include <algorithm>
+
+#include "protection.h"
+
+OverloadCounter::OverloadCounter()
+{
+	count = 0;
+	first = 0;
+}
+
+bool OverloadCounter::sample(float c, uint64_t t, protectparams &params)
+{
+	if (c <= params.threshold) {
+		count = 0;
+		return false;
+	}
+	if (count++ == 0) first = t;
+	return count >= params.samples;
+}
+
+uint64_t OverloadCounter::detected()
+{
+	return first;
+}
+
+
+Protection::Protection(protectparams &params) : p(params), st(PROTECT_OFF)
+{
+	stats = protectstatistics{0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+}
+
+void Protection::arm(bool on)
+{
+	std::lock_guard<std::mutex> lock(m);
+	st = on ? PROTECT_ON : PROTECT_OFF;
+	stats.failures = 0;
+	stats.backoff = p.backoff;
+	stats.restored = 0;
+}
+
+bool Protection::trip(uint64_t now, int latency, bool alert, std::function<void()> off)
+{
+	std::lock_guard<std::mutex> lock(m);
+	if (st != PROTECT_ON) return false;
+	off();
+	stats.trips++;
+	if (alert) stats.alerts++;
+	stats.last = latency;
+	stats.worst = std::max(stats.worst, latency);
+	stats.tripped = now;
+	if ((stats.restored != 0) & (now - stats.restored < (uint64_t) p.clear * 1000)) {
+		stats.failures++;
+		stats.backoff = std::min(stats.backoff * 2, p.backoffmax);
+	}
+	else {
+		stats.failures = 0;
+		stats.backoff = p.backoff;
+	}
+	if (stats.failures >= p.retries) {
+		st = PROTECT_LOCKOUT;
+		stats.lockouts++;
+	}
+	else st = PROTECT_TRIPPED;
+	return true;
+}
+
+bool Protection::restore(uint64_t now, bool user, std::function<void()> power)
+{
+	std::lock_guard<std::mutex> lock(m);
+	if (user) {
+		if (st != PROTECT_LOCKOUT) return false;
+		stats.failures = 0;
+		stats.backoff = p.backoff;
+	}
+	else {
+		if (st != PROTECT_TRIPPED) return false;
+		if (now < stats.tripped + (uint64_t) stats.backoff * 1000) return false;
+	}
+	stats.restores++;
+	stats.restored = now;
+	st = PROTECT_ON;
+	power();
+	return true;
+}
+
+int Protection::remaining(uint64_t now)
+{
+	std::lock_guard<std::mutex> lock(m);
+	int64_t left = (int64_t) (stats.tripped + (uint64_t) stats.backoff * 1000) - (int64_t) now;
+	return left > 0 ? left / 1000 : 0;
+}
+
+int Protection::state()
+{
+	return st;
+}
+
+protectstatistics Protection::statistics()
+{
+	std::lock_guard<std::mutex> lock(m);
+	return stats;
+}
@@ -0,0 +1,104 @@
+/*
+    This file is part of wavedcc,
+    Copyright (C) 2021 Glenn Butcher.
+
+    wavedcc is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    wavedcc is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with wavedcc.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef __PROTECTION_H__
+#define __PROTECTION_H__
+
+#include <stdint.h>
+
+#include <atomic>
+#include <mutex>
+#include <functional>
+
+//Overload protection, without the GPIO: the caller turns the track enables off on a trip, and
+//restore() turns them back on through the caller's power function, so the state machine can be
+//driven by dccsim as well as by the engine.
+//
+//A trip within clear milliseconds of a restore doubles the backoff, up to backoffmax; retries of
+//those in a row lock the protection out, and power stays off until the user restores it.
+
+enum protectstate { PROTECT_OFF, PROTECT_ON, PROTECT_TRIPPED, PROTECT_LOCKOUT };
+
+struct protectparams {
+	float threshold;	//overload threshold, milliamps
+	int samples;		//consecutive samples over threshold that trip the protection
+	int backoff;		//milliseconds from a trip to the restore
+	int backoffmax;		//milliseconds, the most the backoff is doubled to
+	int clear;		//milliseconds after a restore that a trip counts as a failure of it
+	int retries;		//failures in a row that lock the protection out
+};
+
+//Trip statistics.  Latencies are microseconds from the detection of the overload to the enables
+//being off:
+struct protectstatistics {
+	int trips, alerts, restores, lockouts;
+	int last, worst;
+	uint64_t tripped, restored;	//timestamps of the last trip and restore
+	int backoff, failures;		//present backoff, trips in a row within clear of a restore
+};
+
+//Consecutive samples of one sensed track over the threshold:
+class OverloadCounter
+{
+public:
+	OverloadCounter();
+
+	//returns true while the last params.samples samples have been over params.threshold:
+	bool sample(float c, uint64_t t, protectparams &params);
+	uint64_t detected();	//timestamp of the first of them
+
+private:
+	int count;
+	uint64_t first;
+};
+
+//The protection state, shared by the sampling threads, the alert pin callback and the commands.
+//state() is lock-free, for the per-sample checks; the rest serialize on a mutex.  Times are 
+//microsecond timestamps:
+class Protection
+{
+public:
+	explicit Protection(protectparams &params);
+
+	//arms the protection at power on, or turns it off at power off:
+	void arm(bool on);
+
+	//records a trip at now, the caller having turned the enables off as soon as it detected the
+	//overload; off turns them off again under the lock, in case a restore powered the track in 
+	//between.  Returns false if the protection wasn't armed, e.g., already tripped by another path:
+	bool trip(uint64_t now, int latency, bool alert, std::function<void()> off);
+
+	//restores power with user set, from a lockout, otherwise once the backoff of a trip has passed,
+	//rearming the protection and then calling power to turn the enables on, both under the lock, so
+	//a trip detected while the power comes on is recorded, and its off follows the power.  Returns
+	//true if power was restored:
+	bool restore(uint64_t now, bool user, std::function<void()> power);
+
+	int remaining(uint64_t now);	//milliseconds left of the backoff of a trip
+	int state();
+	protectstatistics statistics();
+
+private:
+	protectparams &p;
+	std::atomic<int> st;
+	protectstatistics stats;
+	std::mutex m;
+};
+
+#endif
@@ -0,0 +1,145 @@
+/*
+    This file is part of wavedcc,
+    Copyright (C) 2021 Glenn Butcher.
+
+    wavedcc is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    wavedcc is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with wavedcc.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __SAMPLERING_H__
+#define __SAMPLERING_H__
+
+#include <stdint.h>
+#include <atomic>
+
+struct currentsample {
+	uint64_t tstamp;	//microseconds, CLOCK_MONOTONIC
+	float current;		//milliamps
+	float voltage;
+};
+
+//The latest sample, for readers that only want the present value.  A seqlock: the writer makes
+//seq odd while it updates the fields, and a reader retries its copy until it sees the same even
+//seq before and after.  The writer never waits, and readers never block it or each other, and
+//never see a current from one sample with the voltage of another.
+class SampleSnapshot
+{
+public:
+	SampleSnapshot()
+	{
+		seq = 0;
+		tstamp = 0;
+		current = 0.0;
+		voltage = 0.0;
+	}
+
+	void store(const currentsample &s)
+	{
+		uint64_t q = seq.load(std::memory_order_relaxed);
+		seq.store(q+1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+		tstamp.store(s.tstamp, std::memory_order_relaxed);
+		current.store(s.current, std::memory_order_relaxed);
+		voltage.store(s.voltage, std::memory_order_relaxed);
+		seq.store(q+2, std::memory_order_release);
+	}
+
+	currentsample load()
+	{
+		currentsample s;
+		uint64_t q1, q2;
+		do {
+			q1 = seq.load(std::memory_order_acquire);
+			s.tstamp = tstamp.load(std::memory_order_relaxed);
+			s.current = current.load(std::memory_order_relaxed);
+			s.voltage = voltage.load(std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_acquire);
+			q2 = seq.load(std::memory_order_relaxed);
+		} while ((q1 & 1) | (q1 != q2));
+		return s;
+	}
+
+private:
+	std::atomic<uint64_t> seq;
+	std::atomic<uint64_t> tstamp;
+	std::atomic<float> current;
+	std::atomic<float> voltage;
+};
+
+//Lock-free ring of timestamped current samples.  There is one writer, runDCCCurrent(), and
+//any number of readers, each of which keeps its own position as a sample sequence number.
+//A reader that falls more than N samples behind has lost the overwritten samples; read()
+//returns false for them, and catchup() moves the position up to the oldest one still held.
+//
+//N must be a power of two.
+template <unsigned N>
+class SampleRing
+{
+public:
+	SampleRing()
+	{
+		next = 0;
+		for (unsigned i=0; i<N; i++) slots[i].seq = 0;
+	}
+
+	void push(const currentsample &s)
+	{
+		uint64_t n = next.load(std::memory_order_relaxed);
+		slot &sl = slots[n & (N-1)];
+		sl.seq.store(0, std::memory_order_relaxed);  //mark the slot as being rewritten
+		std::atomic_thread_fence(std::memory_order_release);
+		sl.tstamp.store(s.tstamp, std::memory_order_relaxed);
+		sl.current.store(s.current, std::memory_order_relaxed);
+		sl.voltage.store(s.voltage, std::memory_order_relaxed);
+		sl.seq.store(n+1, std::memory_order_release);
+		next.store(n+1, std::memory_order_release);
+	}
+
+	//sequence number of the next sample to be written:
+	uint64_t head()
+	{
+		return next.load(std::memory_order_acquire);
+	}
+
+	//copies sample n to s, returns false if it hasn't been written yet or has been overwritten:
+	bool read(uint64_t n, currentsample &s)
+	{
+		slot &sl = slots[n & (N-1)];
+		if (sl.seq.load(std::memory_order_acquire) != n+1) return false;
+		s.tstamp = sl.tstamp.load(std::memory_order_relaxed);
+		s.current = sl.current.load(std::memory_order_relaxed);
+		s.voltage = sl.voltage.load(std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_acquire);
+		return sl.seq.load(std::memory_order_relaxed) == n+1;
+	}
+
+	//moves a reader position that has been lapped up to the oldest sample still in the ring:
+	uint64_t catchup(uint64_t n)
+	{
+		uint64_t h = head();
+		if (h - n > N - 1) return h - (N - 1);
+		return n;
+	}
+
+private:
+	struct slot {
+		std::atomic<uint64_t> seq;  //sequence number + 1 of the sample in the slot, 0 while it's being written
+		std::atomic<uint64_t> tstamp;
+		std::atomic<float> current;
+		std::atomic<float> voltage;
+	};
+	slot slots[N];
+	std::atomic<uint64_t> next;
+};
+
+#endif
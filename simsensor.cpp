@@ -0,0 +1,187 @@
+/*
+    This file is part of wavedcc,
+    Copyright (C) 2021 Glenn Butcher.
+
+    wavedcc is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    wavedcc is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with wavedcc.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <time.h>
+#include <stdlib.h>
+
+#include <fstream>
+#include <sstream>
+
+#include "simsensor.h"
+
+void SimulatedDecoder::configure(std::string list)
+{
+	std::stringstream l(list);
+	std::string item;
+	while (std::getline(l, item, ',')) {
+		size_t colon = item.find(':');
+		if (colon == std::string::npos) continue;
+		set(atoi(item.substr(0, colon).c_str()), atoi(item.substr(colon+1).c_str()));
+	}
+}
+
+void SimulatedDecoder::set(unsigned cv, int value)
+{
+	cvs[cv] = value & 0xff;
+}
+
+int SimulatedDecoder::get(unsigned cv)
+{
+	if (cvs.find(cv) == cvs.end()) return -1;
+	return cvs[cv];
+}
+
+//a packet is a preamble of at least 10 ones, then bytes, each after a 0 start bit, and a 1 end
+//bit; the last byte is the exclusive-or of the others.  Spaces, as DCCPacket puts around the
+//start bits, are ignored:
+bool SimulatedDecoder::decode(const std::string &bits, std::vector<uint8_t> &bytes)
+{
+	std::string b;
+	for (unsigned i=0; i<bits.size(); i++) if (bits[i] != ' ') b += bits[i];
+	unsigned i = 0, ck = 0;
+	while ((i < b.size()) && (b[i] == '1')) i++;
+	if (i < 10) return false;
+	bytes.clear();
+	while ((i < b.size()) && (b[i] == '0')) {
+		if (i + 9 >= b.size()) return false;
+		uint8_t byte = 0;
+		for (unsigned j=1; j<=8; j++) byte = (byte << 1) | (b[i+j] == '1');
+		bytes.push_back(byte);
+		ck ^= byte;
+		i += 9;
+	}
+	return (i < b.size()) && (b[i] == '1') && (bytes.size() >= 2) && (ck == 0);
+}
+
+//S-9.2.3 service mode direct, 0111CCAA AAAAAAAA DDDDDDDD EEEEEEEE: CC is 01 verify byte, 11 write
+//byte, 10 bit manipulation, AA... the CV less 1; for a bit manipulation, D is 111KDBBB, K 1 for a 
+//write, D the bit's value and BBB its position:
+bool SimulatedDecoder::receive(const std::string &bits)
+{
+	std::vector<uint8_t> p;
+	if (!decode(bits, p) || (p.size() != 4) || ((p[0] & 0xf0) != 0x70)) return false;
+	unsigned cv = (((p[0] & 0x03) << 8) | p[1]) + 1;
+	int value = get(cv);
+	if (value < 0) return false;
+	switch ((p[0] >> 2) & 0x03) {
+		case 1:
+			return value == p[2];
+		case 3:
+			set(cv, p[2]);
+			return true;
+		case 2: {
+			if ((p[2] & 0xe0) != 0xe0) return false;
+			unsigned bit = (value >> (p[2] & 0x07)) & 1;
+			if (p[2] & 0x10) {
+				set(cv, (value & ~(1 << (p[2] & 0x07))) | (((p[2] >> 3) & 1) << (p[2] & 0x07)));
+				return true;
+			}
+			return bit == (unsigned) ((p[2] >> 3) & 1);
+		}
+	}
+	return false;
+}
+
+SimulatedSensor::SimulatedSensor(float quiescent, float noise, float ack, int ackwidth, int ackperiod, float voltage) : gauss(0.0, 1.0)
+{
+	q = quiescent;
+	n = noise;
+	a = ack;
+	width = ackwidth;
+	period = ackperiod;
+	v = voltage;
+	pos = 0;
+	start = 0;
+	acked = 0;
+}
+
+bool SimulatedSensor::load(std::string tracefile)
+{
+	std::ifstream infile(tracefile.c_str());
+	std::string line;
+	trace.clear();
+	while (std::getline(infile, line)) {
+		if (line.empty() || (line[0] == '#')) continue;
+		std::stringstream l(line);
+		tracesample s;
+		s.voltage = v;
+		if (l >> s.t >> s.current) {
+			l >> s.voltage;
+			trace.push_back(s);
+		}
+	}
+	pos = 0;
+	return trace.size() > 0;
+}
+
+void SimulatedSensor::transmit(const std::string &bits, int micros, uint64_t at, int repeats)
+{
+	if ((repeats >= 2) && decoder.receive(bits)) acked = at + 2 * (uint64_t) micros;
+}
+
+uint64_t SimulatedSensor::now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec*(uint64_t)1000000+ts.tv_nsec/1000;
+}
+
+uint64_t SimulatedSensor::elapsed(uint64_t t)
+{
+	if (start == 0) start = t;
+	return t - start;
+}
+
+//the trace sample at the present time; the last sample is held for the interval before it, 
+//then the trace starts over:
+SimulatedSensor::tracesample &SimulatedSensor::replay(uint64_t now)
+{
+	uint64_t length = trace.back().t + 1;
+	if (trace.size() > 1) length = 2*trace.back().t - trace[trace.size()-2].t;
+	uint64_t t = elapsed(now) % length;
+	if (t < trace[pos].t) pos = 0;
+	while ((pos+1 < trace.size()) && (trace[pos+1].t <= t)) pos++;
+	return trace[pos];
+}
+
+float SimulatedSensor::current(uint64_t t)
+{
+	if (trace.size() > 0) return replay(t).current;
+	float c = q + n * gauss(rng);
+	if ((acked != 0) && (t >= acked) && (t < acked + 1000 * (uint64_t) width)) c += a;
+	else if (period > 0) {
+		if ((elapsed(t) / 1000) % period < (uint64_t) width) c += a;
+	}
+	return c;
+}
+
+float SimulatedSensor::get_current()
+{
+	return current(now());
+}
+
+float SimulatedSensor::get_voltage()
+{
+	if (trace.size() > 0) return replay(now()).voltage;
+	return v;
+}
+
+std::string SimulatedSensor::name()
+{
+	return "sim";
+}
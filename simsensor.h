@@ -0,0 +1,109 @@
+/*
+    This file is part of wavedcc,
+    Copyright (C) 2021 Glenn Butcher.
+
+    wavedcc is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    wavedcc is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with wavedcc.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __SIMSENSOR_H__
+#define __SIMSENSOR_H__
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+#include <map>
+#include <random>
+#include <atomic>
+
+#include "currentsensor.h"
+
+//Simulated decoder on the programming track, answering the S-9.2.3 service mode direct packets
+//the way a decoder does, with an ack: verify byte when the CV holds the value, verify bit when the
+//bit does, and write byte, which also changes the CV.  A CV the decoder doesn't have gets no ack.
+class SimulatedDecoder
+{
+public:
+	//adds the CVs in list, "cv:value,cv:value,...":
+	void configure(std::string list);
+
+	void set(unsigned cv, int value);
+	int get(unsigned cv);	//-1 if the decoder doesn't have the CV
+
+	//returns true if the decoder acks the packet, its bits as from DCCPacket::getPulseString():
+	bool receive(const std::string &bits);
+
+	//the bytes of a packet from its bits, preamble, start bits and end bit; returns false if the
+	//bits aren't a well-formed packet with a good error detection byte:
+	static bool decode(const std::string &bits, std::vector<uint8_t> &bytes);
+
+private:
+	std::map<unsigned, int> cvs;
+};
+
+//Simulated current sensor, for running the current monitoring and ack detection without the 
+//hardware, e.g., to benchmark or regression-test them on any Linux box.  It either replays a
+//recorded trace, or synthesizes a noisy quiescent current with ack pulses.
+//
+//A trace file has a sample per line, "microseconds current [voltage]", the microseconds from the
+//start of the trace.  It's replayed against the time since the first reading, looping at its 
+//end.  Lines starting with # are comments.
+//
+//The synthetic current is quiescent plus gaussian noise of the given standard deviation, with a
+//pulse of ack milliamps over quiescent, ackwidth milliseconds long, when decoder acks a packet 
+//passed to transmit(), and also every ackperiod milliseconds, if it's not 0, for exercising the 
+//ack detector with acks no packet asked for.
+class SimulatedSensor : public CurrentSensor
+{
+public:
+	SimulatedSensor(float quiescent=20.0, float noise=2.0, float ack=70.0, int ackwidth=6, int ackperiod=0, float voltage=15000.0);
+
+	//returns false if the file can't be read or has no samples:
+	bool load(std::string tracefile);
+
+	//the packet with bits, micros long, is sent repeats times from the timestamp at; the decoder
+	//acks following the second, S-9.2.3:
+	void transmit(const std::string &bits, int micros, uint64_t at, int repeats);
+
+	//the current at microsecond timestamp t, on the CLOCK_MONOTONIC timeline of get_current(), so
+	//a driver can run the sensor on a clock of its own:
+	float current(uint64_t t);
+
+	float get_current();
+	float get_voltage();
+	std::string name();
+
+	SimulatedDecoder decoder;
+
+private:
+	struct tracesample {
+		uint64_t t;
+		float current, voltage;
+	};
+
+	uint64_t now();
+	uint64_t elapsed(uint64_t t);  //microseconds since the first reading
+	tracesample &replay(uint64_t t);
+
+	std::vector<tracesample> trace;
+	unsigned pos;	//replay position in trace
+	float q, n, a, v;
+	int width, period;
+	uint64_t start;
+	std::atomic<uint64_t> acked;	//timestamp of the start of the decoder's last ack, 0 if none
+	std::mt19937 rng;
+	std::normal_distribution<float> gauss;
+};
+
+#endif
@@ -35,7 +35,7 @@ int main (int argc, char **argv)
 		std::getline(std::cin, cmd);
 		if (cmd == "exit") break;
 		
-		std::string response = dccCommand(cmd); 
+		std::string response = dccCommand(cmd, [](std::string r) { std::cout << r << std::endl; }); 
 		std::cout << response << std::endl;
 		
 	}
@@ -2,7 +2,7 @@
     This file is part of wavedcc,
     
     The majority of this file is granted to the public domain by
-    Brian “Beej Jorgensen” Hall.  It is the poll()-based chat server
+    Brian “Beej Jorgensen” Hall.  It began as the poll()-based chat server
     posted here: 
     
     https://beej.us/guide/bgnet/examples/pollserver.c, 
@@ -31,7 +31,7 @@
 */
 
 /*
-** pollserver.c -- a cheezy multiperson chat server
+** pollserver.c -- a cheezy multiperson chat server, since rebuilt around epoll
 */
 
 #include <stdio.h>
@@ -44,17 +44,274 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <netdb.h>
-#include <poll.h>
+#include <errno.h>
+#include <limits.h>
 
 //wavedccd-specific:
 #include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <set>
+#include <sstream>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 #include "dccengine.h"
+#include "dcctokens.h"
+#include "dcclocal.h"
+#include "dccbinary.h"
 #include <signal.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <math.h>
 
 #define PORT "9034"   // Port we're listening on
 
+#define MAXINPUT 4096	//longest partial command kept for the next read
+#define MAXPENDING 64	//commands framed and held for a client
+#define READBUDGET 16	//reads of a client's socket per wakeup
+#define RUNBUDGET 32	//commands of a client's run per wakeup
+#define MAXEVENTS 64	//epoll events per wakeup
+#define UDPBATCH 32	//datagrams per recvmmsg()/sendmmsg()
+#define MAXDATAGRAM 1500
+#define MAXRESPONSE 4096	//longest response of a fast command, <cs> with a few dozen windows
+
+//Output queue limit per client, bytes, and what's done with a client whose queue is full: with
+//OUTPUT_DROP the message that doesn't fit is dropped and counted, with OUTPUT_DISCONNECT the 
+//client is disconnected.  The lines of a command's streamed reply, e.g. the <hq> history, which
+//can run to hundreds of kilobytes, are queued whatever the limit, as the engine produces them
+//without waiting for the socket; the limit applies to what else the client has queued, until
+//they're sent.  Set with the -q and -o options:
+enum outputpolicy { OUTPUT_DROP, OUTPUT_DISCONNECT };
+size_t outqueue_max = 65536;
+outputpolicy outqueue_policy = OUTPUT_DISCONNECT;
+
+//Per-client rate limits, token buckets by command class: speed, <t>; function, <F> and <f>; and
+//the other fast commands.  A bucket holds up to burst tokens and refills at rate per second; 
+//each command takes one.  A speed command past the limit is held, the latest one for each 
+//address, and run when the bucket refills, so a throttle sending faster than the limit still
+//ends up at its last setting; the others are refused.  A held command that a later one for the
+//address replaces is still answered, with the reply of the one that's run, so a client gets a 
+//reply per command, though a replaced command's comes later than those of the commands after 
+//it.  Commands for the worker, which wait for it anyway, aren't limited.  Set with 
+//-r class=rate/burst, rate 0 for no limit:
+enum rateclass { RATE_SPEED, RATE_FUNCTION, RATE_OTHER, RATE_CLASSES };
+const char *ratenames[RATE_CLASSES] = { "speed", "function", "other" };
+struct ratelimit {
+	double rate;	//tokens per second
+	double burst;
+};
+ratelimit ratelimits[RATE_CLASSES] = { {20, 40}, {20, 40}, {50, 100} };
+struct bucket {
+	double tokens;
+	uint64_t last;	//milliseconds, CLOCK_MONOTONIC, of the last refill
+};
+
+//per-connection state, by socket.  Output goes through the queue, so a client that isn't reading
+//never blocks the loop; what the socket doesn't take is sent when epoll reports it writable:
+struct client {
+	uint64_t id;			//connection serial number, tells a reused socket from the old one
+	std::string in;			//received input not yet framed into commands
+	std::deque<std::string> pending;	//commands framed, held while one is on the worker
+	bool busy;			//a command of this client's is on the worker
+	bool paused;			//reading stopped with input left in the socket
+	std::set<unsigned> subs;	//locomotive addresses whose state changes are sent to this client
+	bool suball;			//all of them
+	bool binary;			//on the binary port, per dccbinary.h, rather than DCC++ text
+	std::deque<std::string> out;	//replies not yet sent
+	size_t outbytes;		//bytes in out
+	size_t outoff;			//bytes of out.front() already sent
+	size_t exempt;			//bytes of streamed replies in out, not counted against outqueue_max
+	uint64_t sent, dropped;		//messages
+	bucket buckets[RATE_CLASSES];
+	std::map<unsigned, std::pair<std::string, unsigned> > deferred;	//held speed commands, the latest for 
+					//each address, and the replies it owes, for it and those it replaced
+	uint64_t limited, coalesced;	//commands refused by the rate limit, held speed commands replaced
+	bool closing;			//disconnect at the end of this wakeup
+	uint64_t served;		//the last pass of the main loop that read or ran its commands
+	char ip[INET6_ADDRSTRLEN];
+};
+std::map<int, client> clients;
+//The clients with more to do than a wakeup's budget, input left in the socket or commands framed,
+//and not waiting on the worker; the loop serves them again on its next pass, without waiting
+//for an event, as edge triggering won't report the input already there:
+std::set<int> ready;
+uint64_t pass = 0;
+
+int epfd = -1;
+uint64_t connections = 0;
+
+//UDP commands, for handheld throttles: a datagram holds one or more commands, as on the TCP port,
+//and the replies go back to the sender in one datagram.  There's no connection, so a throttle
+//that drops off the network just stops sending.  A datagram can start with a sequence number,
+//@seq, which the reply repeats; one whose seq isn't newer than the last from the sender, a
+//duplicate or one that arrived late, is dropped, so a speed setting is never replaced by an 
+//older one.  seq 0 restarts the sender's sequence.  Senders are forgotten after udpidle_ms 
+//without a datagram.  A command that runs on the worker, per job below, is answered in a 
+//datagram of its own when it's done, with the same @seq; a sender has one at a time.  A speed 
+//command past the rate limit is held, the latest for each address, as a TCP client's, and 
+//answered in a datagram of its own when it's run, with the @seq of the datagram it came in; one
+//that a later command replaces isn't answered.  Subscriptions need a connection, and are 
+//refused.  Enabled with -u port:
+struct udpsender {
+	uint32_t seq;		//last sequence number
+	bool sequenced;		//seq has been set, by the sender's first datagram with one
+	uint64_t last;		//milliseconds, CLOCK_MONOTONIC, of the last datagram
+	bool busy;		//a command of the sender's is on the worker
+	bucket buckets[RATE_CLASSES];
+	std::map<unsigned, std::pair<std::string, std::string> > deferred;	//held speed commands, the latest
+				//for each address, and the @seq tag of the datagram each came in
+};
+std::map<std::string, udpsender> udpsenders;  //by the sender's sockaddr
+int udpfd = -1;
+const char *udpport = NULL;
+uint64_t udpidle_ms = 60000, udpsweep = 0;
+uint64_t udpreceived = 0, udpstale = 0, udplimited = 0, udpcoalesced = 0, udpdropped = 0;
+
+//Local clients, the binary interface of dcclocal.h on the Unix-domain socket at localpath, for 
+//controllers on the same host.  Their commands call the engine directly, with no text to parse
+//or format, and aren't rate limited.  A client can also have a shared-memory ring, which wavedccd
+//runs when the client rings its doorbell.  Enabled with -l path:
+struct localclient {
+	int doorbell;		//the ring's eventfd, -1 if there's no ring
+	void *ring;
+	uint32_t slots;
+	uint64_t tail;		//the ring's, as the client could change the one in the header
+};
+std::map<int, localclient> locals;	//by socket
+std::map<int, int> doorbells;		//socket, by doorbell
+int localfd = -1;
+const char *localpath = NULL;
+uint64_t localcommands = 0, localdropped = 0;	//commands run, replies the sockets wouldn't take
+
+//Binary clients, per dccbinary.h, on binaryport.  Their commands are run as the local clients', 
+//without text, and aren't rate limited, as one frame can set the speeds of dozens of locomotives;
+//the command queue's cap still keeps them from crowding out the others.  The text broadcasts, 
+//power and locomotive state, aren't sent to them.  Enabled with -b port:
+const char *binaryport = NULL;
+uint64_t binaryframes = 0;
+
+//Locomotive state broadcasts.  A change by a throttle or function command is published as the 
+//DCC-EX <l ...> state of the locomotive to the other clients subscribed to it: those that have
+//commanded it, and those that asked with <sub>.  Changes to a locomotive within coalesce_ms of
+//the first are merged into one broadcast of its state at the end of that window.  Set with -c:
+int coalesce_ms = 50;
+struct change {
+	uint64_t due;		//milliseconds, CLOCK_MONOTONIC
+	uint64_t origin;	//connection serial of the client that made the changes, 0 if more than one
+};
+std::map<unsigned, change> changes;
+
+uint64_t millis()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec*(uint64_t)1000+ts.tv_nsec/1000000;
+}
+
+//refills the bucket for the time since the last, and takes a token if there is one:
+bool take(bucket &b, const ratelimit &l, uint64_t now)
+{
+	if (l.rate <= 0) return true;
+	b.tokens += (now - b.last) * l.rate / 1000.0;
+	if (b.tokens > l.burst) b.tokens = l.burst;
+	b.last = now;
+	if (b.tokens < 1.0) return false;
+	b.tokens -= 1.0;
+	return true;
+}
+
+//milliseconds until the bucket has a token again:
+int refill(bucket &b, const ratelimit &l)
+{
+	if ((l.rate <= 0) | (b.tokens >= 1.0)) return 0;
+	return (int) ceil((1.0 - b.tokens) * 1000.0 / l.rate);
+}
+
+rateclass rateClass(cmdtokens &t)
+{
+	if (t.tok[0] == "t") return RATE_SPEED;
+	if ((t.tok[0] == "F") | (t.tok[0] == "f")) return RATE_FUNCTION;
+	return RATE_OTHER;
+}
+
+//the address of a throttle or function command, by their DCC++ and DCC-EX forms:
+bool commandAddress(cmdtokens &t, int &address)
+{
+	if (t.n < 2) return false;
+	return field(t.tok[((t.tok[0] == "t") & (t.n == 5)) ? 2 : 1], address);
+}
+
+//sooner of two epoll_wait() timeouts, -1 being none:
+int soonest(int a, int b)
+{
+	if (a < 0) return b;
+	if (b < 0) return a;
+	return a < b ? a : b;
+}
+
+//The commands that aren't dccConcurrent(), the power, mode and programming commands and the 
+//long-running service mode ones, are run on the worker thread, one at a time and in the order
+//they came in from all the clients, so a <0> waits for the <1> before it, and a <0 PROG> for a
+//CV read.  The frequent ones, the throttle, function and current commands, are run on the loop.
+//The worker posts each streamed result and the final reply to results, and wakes the loop with 
+//wakefd, an eventfd; the loop delivers them to the client.  While a client's command is on the
+//worker, its later commands are held, so its replies keep their order, but other clients' 
+//commands go on.  A UDP sender's job carries its sockaddr, and the reply its @seq:
+struct job {
+	int fd;
+	uint64_t id;
+	std::string cmd;
+	std::string udp;	//sender's sockaddr, for a UDP command
+	std::string tag;	//the datagram's "@seq ", if any
+};
+struct result {
+	int fd;
+	uint64_t id;
+	std::string text;
+	bool done;	//the final reply, as opposed to a streamed result
+	std::string udp, tag;
+};
+std::deque<job> jobs;
+std::deque<result> results;
+std::mutex workmutex;
+std::condition_variable workcv;
+int wakefd = -1;
+
+void post(result r)
+{
+	{
+		std::lock_guard<std::mutex> lock(workmutex);
+		results.push_back(r);
+	}
+	uint64_t one = 1;
+	if (write(wakefd, &one, sizeof(one)) != sizeof(one)) perror("eventfd");
+}
+
+void worker()
+{
+	for (;;) {
+		job j;
+		{
+			std::unique_lock<std::mutex> lock(workmutex);
+			workcv.wait(lock, [] { return jobs.size() > 0; });
+			j = jobs.front();
+			jobs.pop_front();
+		}
+		std::string response = dccCommand(j.cmd, [&j](std::string r) {  //streamed results, e.g., batch CV reads
+			post(result{ j.fd, j.id, r, false, j.udp, j.tag });
+		}); 
+		post(result{ j.fd, j.id, response, true, j.udp, j.tag });
+	}
+}
+
 // Get sockaddr, IPv4 or IPv6:
 void *get_in_addr(struct sockaddr *sa)
 {
@@ -65,8 +322,8 @@ void *get_in_addr(struct sockaddr *sa)
     return &(((struct sockaddr_in6*)sa)->sin6_addr);
 }
 
-// Return a listening socket
-int get_listener_socket(void)
+// Return a non-blocking listening socket
+int get_listener_socket(const char *port)
 {
     int listener;     // Listening socket descriptor
     int yes=1;        // For setsockopt() SO_REUSEADDR, below
@@ -79,13 +336,13 @@ int get_listener_socket(void)
     hints.ai_family = AF_UNSPEC;
     hints.ai_socktype = SOCK_STREAM;
     hints.ai_flags = AI_PASSIVE;
-    if ((rv = getaddrinfo(NULL, PORT, &hints, &ai)) != 0) {
+    if ((rv = getaddrinfo(NULL, port, &hints, &ai)) != 0) {
         fprintf(stderr, "wavedccd: %s\n", gai_strerror(rv));
         exit(1);
     }
     
     for(p = ai; p != NULL; p = p->ai_next) {
-        listener = socket(p->ai_family, p->ai_socktype, p->ai_protocol);
+        listener = socket(p->ai_family, p->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, p->ai_protocol);
         if (listener < 0) { 
             continue;
         }
@@ -116,31 +373,6 @@ int get_listener_socket(void)
     return listener;
 }
 
-// Add a new file descriptor to the set
-void add_to_pfds(struct pollfd *pfds[], int newfd, int *fd_count, int *fd_size)
-{
-    // If we don't have room, add more space in the pfds array
-    if (*fd_count == *fd_size) {
-        *fd_size *= 2; // Double it
-
-        *pfds = (pollfd*) realloc(*pfds, sizeof(**pfds) * (*fd_size));
-    }
-
-    (*pfds)[*fd_count].fd = newfd;
-    (*pfds)[*fd_count].events = POLLIN; // Check ready-to-read
-
-    (*fd_count)++;
-}
-
-// Remove an index from the set
-void del_from_pfds(struct pollfd pfds[], int i, int *fd_count)
-{
-    // Copy the one from the end over this one
-    pfds[i] = pfds[*fd_count-1];
-
-    (*fd_count)--;
-}
-
 //added for wavedccd():
 void daemonize()
 {
@@ -162,6 +394,840 @@ void daemonize()
 	signal(SIGTTIN,SIG_IGN);
 }
 
+//moves the complete commands at the head of in to cmds, leaving a partial one for the next read.
+//A command is a <...> frame or, for typing at a telnet session, a line of text outside of one.
+//Input that can't be a command, a partial one longer than MAXINPUT, is discarded:
+void frame(std::string &in, std::vector<std::string> &cmds)
+{
+	size_t pos = 0, end;
+	while (pos < in.size()) {
+		if ((in[pos] == ' ') | (in[pos] == '\t') | (in[pos] == '\r') | (in[pos] == '\n')) {
+			pos++;
+			continue;
+		}
+		if (in[pos] == '<') {
+			if ((end = in.find('>', pos)) == std::string::npos) break;
+			cmds.push_back(in.substr(pos, end - pos + 1));
+		}
+		else {
+			if ((end = in.find_first_of("<\n", pos)) == std::string::npos) break;
+			if (in[end] == '<') end--;  //the line ends at the frame
+			std::string line = in.substr(pos, end - pos + 1);
+			line.erase(line.find_last_not_of(" \n\r\t")+1);
+			if (line.size() > 0) cmds.push_back(line);
+		}
+		pos = end + 1;
+	}
+	in.erase(0, pos);
+	if (in.size() > MAXINPUT) in.clear();
+}
+
+//sends as much of the client's queue as the socket takes, in one sendmsg() per IOV_MAX messages.
+//Returns false if the connection has failed:
+bool flush(int fd, client &cl)
+{
+	while (cl.out.size() > 0) {
+		struct iovec iov[IOV_MAX];
+		int n = 0;
+		for (std::deque<std::string>::iterator m = cl.out.begin(); (m != cl.out.end()) & (n < IOV_MAX); m++, n++) {
+			iov[n].iov_base = (void *) m->data();
+			iov[n].iov_len = m->size();
+		}
+		iov[0].iov_base = (char *) iov[0].iov_base + cl.outoff;
+		iov[0].iov_len -= cl.outoff;
+
+		struct msghdr msg;
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = iov;
+		msg.msg_iovlen = n;
+		ssize_t sent = sendmsg(fd, &msg, MSG_NOSIGNAL);
+		if (sent < 0) {
+			if (errno == EINTR) continue;
+			if ((errno == EAGAIN) | (errno == EWOULDBLOCK)) return true;  //the rest goes on EPOLLOUT
+			return false;
+		}
+		sent += cl.outoff;
+		cl.outoff = 0;
+		while ((cl.out.size() > 0) && ((size_t) sent >= cl.out.front().size())) {
+			sent -= cl.out.front().size();
+			cl.outbytes -= cl.out.front().size();
+			cl.out.pop_front();
+			cl.sent++;
+		}
+		cl.outoff = sent;
+		cl.exempt = std::min(cl.exempt, cl.outbytes);  //the streamed replies, queued last, go last
+	}
+	return true;
+}
+
+//queues a message to the client, applying the output policy if the queue is full, unless it's a
+//line of a streamed reply.  Sending is left to flush(), so a batch of replies goes out together:
+void enqueue(int fd, client &cl, const std::string &m, bool streamed=false)
+{
+	if ((m.size() == 0) | cl.closing) return;
+	if (streamed) cl.exempt += m.size();
+	else if (cl.outbytes - cl.exempt + m.size() > outqueue_max) {
+		if (outqueue_policy == OUTPUT_DISCONNECT) {
+			printf("wavedccd: socket %d output queue full, disconnecting\n", fd);
+			cl.closing = true;
+		}
+		else cl.dropped++;
+		return;
+	}
+	cl.out.push_back(m);
+	cl.outbytes += m.size();
+}
+
+void disconnect(int fd)
+{
+	epoll_ctl(epfd, EPOLL_CTL_DEL, fd, NULL);
+	close(fd); // Bye!
+	clients.erase(fd);
+	ready.erase(fd);
+}
+
+//accepts all the pending connections; with edge triggering, the listener reports readable once
+//for however many there are:
+void acceptClients(int listener, bool binary)
+{
+	struct sockaddr_storage remoteaddr; // Client address
+	socklen_t addrlen;
+	for (;;) {
+		addrlen = sizeof remoteaddr;
+		int newfd = accept4(listener, (struct sockaddr *)&remoteaddr, &addrlen, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (newfd == -1) {
+			if ((errno != EAGAIN) & (errno != EWOULDBLOCK) & (errno != EINTR)) perror("accept");
+			if (errno == EINTR) continue;
+			return;
+		}
+		client &cl = clients[newfd];
+		cl = client();
+		cl.id = ++connections;
+		cl.binary = binary;
+		for (int i=0; i<RATE_CLASSES; i++) cl.buckets[i] = bucket{ ratelimits[i].burst, millis() };
+		inet_ntop(remoteaddr.ss_family, get_in_addr((struct sockaddr*)&remoteaddr), cl.ip, INET6_ADDRSTRLEN);
+
+		struct epoll_event ev;
+		ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+		ev.data.fd = newfd;
+		epoll_ctl(epfd, EPOLL_CTL_ADD, newfd, &ev);
+
+		printf("wavedccd: new connection from %s on socket %d\n", cl.ip, newfd);
+	}
+}
+
+//wavedccd's own status, <ns>: the connection count and the long-running commands waiting for the
+//worker, then a line per client, 
+//<ns socket address queued_messages queued_bytes sent dropped busy limited held coalesced>:
+std::string networkStatus()
+{
+	std::stringstream r;
+	size_t waiting;
+	{
+		std::lock_guard<std::mutex> lock(workmutex);
+		waiting = jobs.size();
+	}
+	r << "<ns connections " << clients.size() << " queuemax " << outqueue_max << " " 
+	  << (outqueue_policy == OUTPUT_DROP ? "drop" : "disconnect") << " jobs " << waiting << ">";
+	if (binaryport) {
+		int binaries = 0;
+		for (std::map<int, client>::iterator c = clients.begin(); c != clients.end(); c++) binaries += c->second.binary;
+		r << "\n<ns binary " << binaryport << " clients " << binaries << " frames " << binaryframes << ">";
+	}
+	if (localfd >= 0) 
+		r << "\n<ns local " << localpath << " clients " << locals.size() << " rings " << doorbells.size() 
+		  << " commands " << localcommands << " dropped " << localdropped << ">";
+	if (udpfd >= 0) 
+		r << "\n<ns udp " << udpport << " senders " << udpsenders.size() << " received " << udpreceived 
+		  << " stale " << udpstale << " limited " << udplimited << " coalesced " << udpcoalesced 
+		  << " dropped " << udpdropped << ">";
+	for (std::map<int, client>::iterator c = clients.begin(); c != clients.end(); c++) {
+		r << "\n<ns " << c->first << " " << c->second.ip << " " << c->second.out.size() << " " 
+		  << c->second.outbytes << " " << c->second.sent << " " << c->second.dropped << " " << c->second.busy << " " 
+		  << c->second.limited << " " << c->second.deferred.size() << " " << c->second.coalesced << ">";
+	}
+	return r.str();
+}
+
+//records a change to the locomotive at address, for the broadcast.  origin is the connection 
+//serial of the client that made it, 0 for a UDP sender:
+void publish(unsigned address, uint64_t origin)
+{
+	std::map<unsigned, change>::iterator c = changes.find(address);
+	if (c == changes.end()) changes[address] = change{ millis() + coalesce_ms, origin };
+	else if (c->second.origin != origin) c->second.origin = 0;
+}
+
+//the client that commands a locomotive is subscribed to it:
+void publish(unsigned address, client &cl)
+{
+	cl.subs.insert(address);
+	publish(address, cl.id);
+}
+
+//sends the state of the locomotives whose coalescing window has closed to their subscribers. 
+//Returns the milliseconds to the next window's close, -1 if there's none:
+int runBroadcasts()
+{
+	uint64_t now = millis();
+	int next = -1;
+	for (std::map<unsigned, change>::iterator c = changes.begin(); c != changes.end(); ) {
+		if (c->second.due > now) {
+			int wait = c->second.due - now;
+			if ((next < 0) | (wait < next)) next = wait;
+			c++;
+			continue;
+		}
+		std::string state = dccLocoState(c->first);
+		for (std::map<int, client>::iterator d = clients.begin(); d != clients.end(); d++) {
+			client &cl = d->second;
+			if ((cl.id == c->second.origin) | cl.binary | !(cl.suball | (cl.subs.count(c->first) > 0))) continue;
+			enqueue(d->first, cl, state);
+			if (!flush(d->first, cl)) cl.closing = true;
+		}
+		changes.erase(c++);
+	}
+	return next;
+}
+
+//<sub [address ...]> subscribes the client to the state changes of the locomotives, all of them
+//if none are given; <unsub [address ...]> unsubscribes, from all if none are given.  Returns the
+//subscriptions, <sub all> or <sub address ...>:
+std::string subscribe(client &cl, cmdtokens &t)
+{
+	bool sub = t.tok[0] == "sub";
+	int address;
+	if (t.n == 1) {
+		cl.suball = sub;
+		if (!sub) cl.subs.clear();
+	}
+	for (unsigned i=1; i<t.n; i++) {
+		if (!field(t.tok[i], address)) return "<Error: malformed command.>";
+		if (sub) cl.subs.insert(address); else cl.subs.erase(address);
+	}
+	std::stringstream r;
+	r << "<sub";
+	if (cl.suball) r << " all";
+	else for (std::set<unsigned>::iterator a = cl.subs.begin(); a != cl.subs.end(); a++) r << " " << *a;
+	r << ">";
+	return r.str();
+}
+
+//sends a power state reply to the clients other than socket fd:
+void broadcastPower(int fd, std::string_view response)
+{
+	if (response.find("<p") == std::string_view::npos) return;
+	std::string m(response);
+	for (std::map<int, client>::iterator d = clients.begin(); d != clients.end(); d++) {
+		if ((d->first != fd) & !d->second.binary) {
+			enqueue(d->first, d->second, m);
+			if (!flush(d->first, d->second)) d->second.closing = true;
+		}
+	}
+}
+
+//queues a reply to the client; power state replies go to everyone:
+void deliver(int fd, client &cl, const std::string &response)
+{
+	broadcastPower(fd, response);
+	enqueue(fd, cl, response);
+}
+
+//runs a fast command, and records the locomotive state change for the broadcast.  The response
+//goes to a buffer, the engine's path without allocation, and is copied once, to the queue:
+void execute(int fd, client &cl, const std::string &cmd, cmdtokens &t, unsigned replies=1)
+{
+	char buf[MAXRESPONSE];
+	int n = dccCommand(cmd.data(), cmd.size(), buf, sizeof(buf), [fd, &cl](std::string r) {
+		enqueue(fd, cl, r, true);
+		flush(fd, cl);
+	}); 
+	std::string response(buf, n);
+	deliver(fd, cl, response);
+	for (unsigned i=1; i<replies; i++) enqueue(fd, cl, response);  //for the held commands it replaced
+
+	//throttle and function commands change a locomotive's state:
+	int address;
+	if (((t.tok[0] == "t") | (t.tok[0] == "F") | (t.tok[0] == "f")) && (response.find("Error") == std::string::npos)
+	    && commandAddress(t, address)) 
+		publish(address, cl);
+}
+
+//runs a fast command from a UDP sender, and appends its response to reply, from the buffer:
+void executeUDP(const std::string &cmd, cmdtokens &t, std::string &reply)
+{
+	char buf[MAXRESPONSE];
+	int n = dccCommand(cmd.data(), cmd.size(), buf, sizeof(buf), [&reply](std::string r) { reply += r; });
+	std::string_view response(buf, n);
+	broadcastPower(-1, response);
+	reply += response;
+
+	int address;
+	if (((t.tok[0] == "t") | (t.tok[0] == "F") | (t.tok[0] == "f")) && (response.find("Error") == std::string_view::npos)
+	    && commandAddress(t, address)) 
+		publish(address, 0);
+}
+
+//runs the commands framed from a client's input, up to one for the worker, whose reply the rest
+//wait for, and RUNBUDGET in all; the rest are left for the next pass:
+void runCommands(int fd, client &cl)
+{
+	int run = 0;
+	while ((cl.pending.size() > 0) & !cl.busy & (run++ < RUNBUDGET)) {
+		std::string cmd = cl.pending.front();
+		cl.pending.pop_front();
+		cmdtokens t;
+		if (!tokenize(cmd, t)) continue;
+		if (t.tok[0] == "ns") {
+			enqueue(fd, cl, networkStatus());
+			continue;
+		}
+		if ((t.tok[0] == "sub") | (t.tok[0] == "unsub")) {
+			enqueue(fd, cl, subscribe(cl, t));
+			continue;
+		}
+		if (!dccConcurrent(cmd)) {
+			cl.busy = true;
+			{
+				std::lock_guard<std::mutex> lock(workmutex);
+				jobs.push_back(job{ fd, cl.id, cmd, "", "" });
+			}
+			workcv.notify_one();
+			break;
+		}
+
+		rateclass rc = rateClass(t);
+		int address;
+		bool speed = (rc == RATE_SPEED) && commandAddress(t, address) && (address > 0) && (address <= 10239);
+		unsigned replies = 1;
+		if (speed && (cl.deferred.count(address) > 0)) {  //superseded
+			replies += cl.deferred[address].second;
+			cl.deferred.erase(address);
+			cl.coalesced++;
+		}
+		if (!take(cl.buckets[rc], ratelimits[rc], millis())) {
+			if (speed) cl.deferred[address] = std::make_pair(cmd, replies);
+			else {
+				cl.limited++;
+				enqueue(fd, cl, "<Error: rate limited.>");
+			}
+			continue;
+		}
+		execute(fd, cl, cmd, t, replies);
+	}
+}
+
+//runs the held speed commands the clients' buckets have refilled for.  Returns the milliseconds
+//to the next refill a held command is waiting for, -1 if there's none:
+int runDeferred()
+{
+	uint64_t now = millis();
+	int next = -1;
+	for (std::map<int, client>::iterator c = clients.begin(); c != clients.end(); c++) {
+		client &cl = c->second;
+		if ((cl.deferred.size() == 0) | cl.busy | cl.closing) continue;
+		bucket &b = cl.buckets[RATE_SPEED];
+		while ((cl.deferred.size() > 0) && take(b, ratelimits[RATE_SPEED], now)) {
+			std::string cmd = cl.deferred.begin()->second.first;
+			unsigned replies = cl.deferred.begin()->second.second;
+			cl.deferred.erase(cl.deferred.begin());
+			cmdtokens t;
+			if (tokenize(cmd, t)) execute(c->first, cl, cmd, t, replies);
+		}
+		if (cl.deferred.size() > 0) next = soonest(next, refill(b, ratelimits[RATE_SPEED]));
+		if (!flush(c->first, cl)) cl.closing = true;
+	}
+	for (std::map<std::string, udpsender>::iterator s = udpsenders.begin(); s != udpsenders.end(); s++) {
+		udpsender &u = s->second;
+		if (u.deferred.size() == 0) continue;
+		bucket &b = u.buckets[RATE_SPEED];
+		while ((u.deferred.size() > 0) && take(b, ratelimits[RATE_SPEED], now)) {
+			std::string cmd = u.deferred.begin()->second.first;
+			std::string reply = u.deferred.begin()->second.second;
+			u.deferred.erase(u.deferred.begin());
+			cmdtokens t;
+			if (!tokenize(cmd, t)) continue;
+			executeUDP(cmd, t, reply);
+			if (sendto(udpfd, reply.data(), reply.size(), 0, (struct sockaddr *) s->first.data(), s->first.size()) < 0) 
+				udpdropped++;
+		}
+		if (u.deferred.size() > 0) next = soonest(next, refill(b, ratelimits[RATE_SPEED]));
+	}
+	return next;
+}
+
+//runs a local or binary client's command:
+dcclocostatus runLocal(const dcclococommand &c)
+{
+	dcclocostatus st;
+	int speed = 0, direction = 0;
+	uint32_t functions = 0;
+	int result = DCC_OK;
+	if (c.flags & DCCLOCAL_SPEED) result = dccSetSpeed(c.address, c.speed, (c.flags & DCCLOCAL_FORWARD) != 0);
+	if ((result == DCC_OK) & (c.fmask != 0)) result = dccSetFunctions(c.address, c.functions, c.fmask);
+	if ((result == DCC_OK) & (((c.flags & DCCLOCAL_SPEED) != 0) | (c.fmask != 0))) publish(c.address, 0);
+	dccGetLoco(c.address, speed, direction, functions);
+	st.address = c.address;
+	st.speed = speed;
+	st.direction = direction;
+	st.functions = functions;
+	st.result = result;
+	return st;
+}
+
+//runs the complete frames in a binary client's input, leaving a partial one for the next read:
+void runBinary(int fd, client &cl)
+{
+	size_t pos = 0;
+	while (cl.in.size() - pos >= sizeof(uint16_t)) {
+		uint16_t len;
+		memcpy(&len, cl.in.data() + pos, sizeof(len));
+		len = ntohs(len);
+		if (cl.in.size() - pos - sizeof(len) < len) break;
+		const char *f = cl.in.data() + pos + sizeof(len);
+		pos += sizeof(len) + len;
+		binaryframes++;
+
+		dccbinaryheader h = { DCCBINARY_ERROR, 0, 0 };
+		if (len >= sizeof(h)) memcpy(&h, f, sizeof(h));
+		unsigned count = (len - sizeof(h)) / sizeof(dcclococommand);
+		std::string reply;
+		if ((len < sizeof(h)) || (h.op != DCCBINARY_COMMANDS) || ((len - sizeof(h)) % sizeof(dcclococommand) != 0)) {
+			count = 0;
+			h.op = DCCBINARY_ERROR;
+		}
+		else h.op = DCCBINARY_STATUS;
+		uint16_t rlen = htons(sizeof(h) + count * sizeof(dcclocostatus));
+		reply.reserve(sizeof(rlen) + sizeof(h) + count * sizeof(dcclocostatus));
+		reply.append((char *) &rlen, sizeof(rlen));
+		reply.append((char *) &h, sizeof(h));
+		for (unsigned i=0; i<count; i++) {
+			dcclococommand c;
+			memcpy(&c, f + sizeof(h) + i * sizeof(c), sizeof(c));
+			dccbinarySwap(c);
+			dcclocostatus st = runLocal(c);
+			dccbinarySwap(st);
+			reply.append((char *) &st, sizeof(st));
+		}
+		enqueue(fd, cl, reply);
+	}
+	cl.in.erase(0, pos);
+}
+
+bool readClient(int fd, client &cl);
+
+//reads a client's input and runs its commands, a wakeup's budget of each; a client that has more
+//left, and isn't waiting on the worker, goes on the ready list:
+void serve(int fd, client &cl)
+{
+	cl.served = pass;
+	if (!readClient(fd, cl)) cl.closing = true;
+	if (cl.binary) runBinary(fd, cl); else runCommands(fd, cl);
+	if (!cl.closing & !cl.busy & (cl.paused | (cl.pending.size() > 0))) ready.insert(fd);
+}
+
+//delivers the worker's results to their clients, those still connected, and runs the commands
+//that were held for the final replies:
+void runResults()
+{
+	uint64_t count;
+	while (read(wakefd, &count, sizeof(count)) == sizeof(count));  //reset the eventfd
+	std::deque<result> r;
+	{
+		std::lock_guard<std::mutex> lock(workmutex);
+		r.swap(results);
+	}
+	for (unsigned i=0; i<r.size(); i++) {
+		if (r[i].udp.size() > 0) {
+			if (r[i].done) {
+				broadcastPower(-1, r[i].text);
+				std::map<std::string, udpsender>::iterator s = udpsenders.find(r[i].udp);
+				if (s != udpsenders.end()) s->second.busy = false;
+			}
+			std::string d = r[i].tag + r[i].text;
+			if ((d.size() > 0) && (sendto(udpfd, d.data(), d.size(), 0, (struct sockaddr *) r[i].udp.data(), r[i].udp.size()) < 0)) 
+				udpdropped++;
+			continue;
+		}
+		std::map<int, client>::iterator c = clients.find(r[i].fd);
+		if ((c == clients.end()) || (c->second.id != r[i].id)) continue;  //hung up while the command ran
+		client &cl = c->second;
+		if (r[i].done) {
+			deliver(r[i].fd, cl, r[i].text);
+			cl.busy = false;
+			runCommands(r[i].fd, cl);
+			if (cl.paused | (cl.pending.size() > 0)) serve(r[i].fd, cl);  //the rest of its input
+		}
+		else enqueue(r[i].fd, cl, r[i].text, true);
+		if (!flush(r[i].fd, cl)) cl.closing = true;
+	}
+}
+
+//reads what the client has sent, and frames the commands into pending; with edge triggering,
+//until the socket would block.  Reading stops, paused, after READBUDGET reads, so one client 
+//can't hold the loop, or once MAXPENDING commands are held, so a client can't grow the daemon's
+//memory; it's held up by TCP instead.  The rest is left in the socket, for the next pass or, 
+//while a command of the client's is on the worker, its reply.  Returns false when the client has
+//hung up or the connection has failed:
+bool readClient(int fd, client &cl)
+{
+	char buf[4096];    // Buffer for client data
+	int reads = 0;
+	cl.paused = false;
+	for (;;) {
+		if ((reads == READBUDGET) | (cl.pending.size() >= MAXPENDING)) {
+			cl.paused = true;
+			return true;
+		}
+		int nbytes = recv(fd, buf, sizeof buf, 0);
+		if (nbytes > 0) {
+			reads++;
+			cl.in.append(buf, nbytes);
+			if (!cl.binary) {
+				std::vector<std::string> cmds;
+				frame(cl.in, cmds);
+				cl.pending.insert(cl.pending.end(), cmds.begin(), cmds.end());
+			}
+			continue;
+		}
+		if (nbytes == 0) {
+			printf("wavedccd: socket %d hung up\n", fd);
+			return false;
+		}
+		if (errno == EINTR) continue;
+		if ((errno == EAGAIN) | (errno == EWOULDBLOCK)) return true;
+		perror("recv");
+		return false;
+	}
+}
+
+
+// Return a non-blocking UDP socket bound to port
+int get_udp_socket(const char *port)
+{
+	int sock = -1, rv;
+	struct addrinfo hints, *ai, *p;
+
+	memset(&hints, 0, sizeof hints);
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_DGRAM;
+	hints.ai_flags = AI_PASSIVE;
+	if ((rv = getaddrinfo(NULL, port, &hints, &ai)) != 0) {
+		fprintf(stderr, "wavedccd: %s\n", gai_strerror(rv));
+		exit(1);
+	}
+	for (p = ai; p != NULL; p = p->ai_next) {
+		sock = socket(p->ai_family, p->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, p->ai_protocol);
+		if (sock < 0) continue;
+		if (bind(sock, p->ai_addr, p->ai_addrlen) == 0) break;
+		close(sock);
+		sock = -1;
+	}
+	freeaddrinfo(ai);
+	return sock;
+}
+
+//runs the commands in a datagram from the sender, and returns the reply:
+std::string runDatagram(const std::string &sender, udpsender &u, std::string d)
+{
+	std::string reply, tag;
+	if (d[0] == '@') {
+		size_t end = d.find_first_of(" \t\r\n<");
+		uint32_t seq;
+		if (!field(std::string_view(d).substr(1, end == std::string::npos ? std::string::npos : end-1), seq)) return "";
+		if (u.sequenced & (seq != 0) & ((int32_t) (seq - u.seq) <= 0)) {
+			udpstale++;
+			return "";
+		}
+		u.seq = seq;
+		u.sequenced = true;
+		tag = reply = d.substr(0, end) + " ";
+		d.erase(0, end);
+	}
+	d += "\n";  //ends a bare command
+
+	std::vector<std::string> cmds;
+	frame(d, cmds);
+	for (unsigned i=0; i<cmds.size(); i++) {
+		cmdtokens t;
+		if (!tokenize(cmds[i], t)) continue;
+		if ((t.tok[0] == "ns") | (t.tok[0] == "sub") | (t.tok[0] == "unsub")) {
+			reply += "<Error: not available over UDP.>";
+			continue;
+		}
+		if (!dccConcurrent(cmds[i])) {
+			if (u.busy) {
+				reply += "<Error: busy.>";
+				continue;
+			}
+			u.busy = true;
+			{
+				std::lock_guard<std::mutex> lock(workmutex);
+				jobs.push_back(job{ -1, 0, cmds[i], sender, tag });
+			}
+			workcv.notify_one();
+			continue;
+		}
+		rateclass rc = rateClass(t);
+		int address;
+		bool speed = (rc == RATE_SPEED) && commandAddress(t, address) && (address > 0) && (address <= 10239);
+		if (speed && (u.deferred.erase(address) > 0)) udpcoalesced++;  //superseded
+		if (!take(u.buckets[rc], ratelimits[rc], millis())) {
+			if (speed) u.deferred[address] = std::make_pair(cmds[i], tag);
+			else {
+				udplimited++;
+				reply += "<Error: rate limited.>";
+			}
+			continue;
+		}
+		executeUDP(cmds[i], t, reply);
+	}
+	if (reply == tag) return "";  //all on the worker, or held
+	return reply;
+}
+
+//receives the waiting datagrams, UDPBATCH to a recvmmsg(), runs them, and sends the replies of
+//each batch with one sendmmsg():
+void readUDP()
+{
+	static char bufs[UDPBATCH][MAXDATAGRAM];
+	struct sockaddr_storage addrs[UDPBATCH];
+	struct iovec iov[UDPBATCH];
+	struct mmsghdr msgs[UDPBATCH];
+	std::string replies[UDPBATCH];
+	struct iovec riov[UDPBATCH];
+	struct mmsghdr rmsgs[UDPBATCH];
+
+	for (;;) {
+		for (int i=0; i<UDPBATCH; i++) {
+			iov[i].iov_base = bufs[i];
+			iov[i].iov_len = MAXDATAGRAM;
+			memset(&msgs[i], 0, sizeof(msgs[i]));
+			msgs[i].msg_hdr.msg_iov = &iov[i];
+			msgs[i].msg_hdr.msg_iovlen = 1;
+			msgs[i].msg_hdr.msg_name = &addrs[i];
+			msgs[i].msg_hdr.msg_namelen = sizeof(addrs[i]);
+		}
+		int n = recvmmsg(udpfd, msgs, UDPBATCH, 0, NULL);
+		if (n < 0) {
+			if (errno == EINTR) continue;
+			if ((errno != EAGAIN) & (errno != EWOULDBLOCK)) perror("recvmmsg");
+			return;
+		}
+
+		uint64_t now = millis();
+		int r = 0;
+		for (int i=0; i<n; i++) {
+			if (msgs[i].msg_len == 0) continue;
+			udpreceived++;
+			std::string key((char *) &addrs[i], msgs[i].msg_hdr.msg_namelen);
+			std::map<std::string, udpsender>::iterator s = udpsenders.find(key);
+			if (s == udpsenders.end()) {
+				s = udpsenders.insert(std::make_pair(key, udpsender())).first;
+				s->second.seq = 0;
+				s->second.sequenced = false;
+				s->second.busy = false;
+				for (int c=0; c<RATE_CLASSES; c++) s->second.buckets[c] = bucket{ ratelimits[c].burst, now };
+			}
+			s->second.last = now;
+			replies[r] = runDatagram(key, s->second, std::string(bufs[i], msgs[i].msg_len));
+			if (replies[r].size() == 0) continue;
+			riov[r].iov_base = (void *) replies[r].data();
+			riov[r].iov_len = replies[r].size();
+			memset(&rmsgs[r], 0, sizeof(rmsgs[r]));
+			rmsgs[r].msg_hdr.msg_iov = &riov[r];
+			rmsgs[r].msg_hdr.msg_iovlen = 1;
+			rmsgs[r].msg_hdr.msg_name = &addrs[i];
+			rmsgs[r].msg_hdr.msg_namelen = msgs[i].msg_hdr.msg_namelen;
+			r++;
+		}
+
+		//a reply the socket won't take now is dropped; the throttle sends again:
+		int sent = 0;
+		while (sent < r) {
+			int m = sendmmsg(udpfd, rmsgs + sent, r - sent, 0);
+			if (m < 0) {
+				if (errno == EINTR) continue;
+				if ((errno != EAGAIN) & (errno != EWOULDBLOCK)) perror("sendmmsg");
+				break;
+			}
+			sent += m;
+		}
+		udpdropped += r - sent;
+
+		if (now - udpsweep > udpidle_ms) {
+			for (std::map<std::string, udpsender>::iterator s = udpsenders.begin(); s != udpsenders.end(); ) {
+				if (now - s->second.last > udpidle_ms) udpsenders.erase(s++); else s++;
+			}
+			udpsweep = now;
+		}
+		if (n < UDPBATCH) return;
+	}
+}
+
+// Return a non-blocking listening Unix-domain socket, SOCK_SEQPACKET, at path
+int get_local_socket(const char *path)
+{
+	struct sockaddr_un addr;
+	if (strlen(path) >= sizeof(addr.sun_path)) return -1;
+	int sock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (sock < 0) return -1;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+	unlink(path);  //left by a previous run
+	if ((bind(sock, (struct sockaddr *) &addr, sizeof(addr)) < 0) | (listen(sock, 10) < 0)) {
+		close(sock);
+		return -1;
+	}
+	return sock;
+}
+
+void acceptLocals()
+{
+	for (;;) {
+		int newfd = accept4(localfd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (newfd == -1) {
+			if (errno == EINTR) continue;
+			if ((errno != EAGAIN) & (errno != EWOULDBLOCK)) perror("accept");
+			return;
+		}
+		locals[newfd] = localclient{ -1, NULL, 0, 0 };
+
+		struct epoll_event ev;
+		ev.events = EPOLLIN | EPOLLRDHUP | EPOLLET;
+		ev.data.fd = newfd;
+		epoll_ctl(epfd, EPOLL_CTL_ADD, newfd, &ev);
+	}
+}
+
+void disconnectLocal(int fd)
+{
+	localclient &lc = locals[fd];
+	if (lc.doorbell >= 0) {
+		//the client holds the doorbell too, so closing it doesn't take it out of the epoll set:
+		epoll_ctl(epfd, EPOLL_CTL_DEL, lc.doorbell, NULL);
+		close(lc.doorbell);
+		doorbells.erase(lc.doorbell);
+		munmap(lc.ring, dccringsize(lc.slots));
+	}
+	epoll_ctl(epfd, EPOLL_CTL_DEL, fd, NULL);
+	close(fd);
+	locals.erase(fd);
+}
+
+//sets up the client's ring, and sends it the ring's memory and doorbell.  Returns the slots, 0 if
+//the ring couldn't be set up:
+uint32_t setupRing(int fd, localclient &lc, uint32_t slots)
+{
+	dcclocalheader reply = { DCCLOCAL_RING, 0 };
+	int memfd = -1;
+	if ((lc.doorbell < 0) & (slots > 0) & (slots <= DCCLOCAL_MAXSLOTS) & ((slots & (slots-1)) == 0)) {
+		//sealed at its size, so the client can't truncate it from under the mapping:
+		memfd = memfd_create("wavedccd-ring", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+		void *m = MAP_FAILED;
+		if ((memfd >= 0) && (ftruncate(memfd, dccringsize(slots)) == 0) 
+		    && (fcntl(memfd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) == 0))
+			m = mmap(NULL, dccringsize(slots), PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0);
+		int bell = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		if ((m != MAP_FAILED) & (bell >= 0)) {
+			DCCRing(m, slots).init();
+			lc.ring = m;
+			lc.slots = slots;
+			lc.tail = 0;
+			lc.doorbell = bell;
+			doorbells[bell] = fd;
+			struct epoll_event ev;
+			ev.events = EPOLLIN | EPOLLET;
+			ev.data.fd = bell;
+			epoll_ctl(epfd, EPOLL_CTL_ADD, bell, &ev);
+			reply.count = slots;
+		}
+		else {
+			if (m != MAP_FAILED) munmap(m, dccringsize(slots));
+			if (bell >= 0) close(bell);
+		}
+	}
+
+	struct iovec iov = { &reply, sizeof(reply) };
+	struct msghdr msg;
+	char control[CMSG_SPACE(2 * sizeof(int))];
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	if (reply.count > 0) {
+		int fds[2] = { memfd, lc.doorbell };
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+		struct cmsghdr *cm = CMSG_FIRSTHDR(&msg);
+		cm->cmsg_level = SOL_SOCKET;
+		cm->cmsg_type = SCM_RIGHTS;
+		cm->cmsg_len = CMSG_LEN(sizeof(fds));
+		memcpy(CMSG_DATA(cm), fds, sizeof(fds));
+	}
+	if (sendmsg(fd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT) < 0) localdropped++;
+	if (memfd >= 0) close(memfd);  //the mapping stays
+	return reply.count;
+}
+
+//runs the commands in the client's ring, until it's empty with the doorbell armed, or a ring's
+//worth have been run; then the doorbell is rung for the rest, so a client that keeps the ring 
+//full doesn't keep the loop from the others.  Returns false if the client has broken the ring:
+bool runRing(localclient &lc)
+{
+	uint64_t count;
+	while (read(lc.doorbell, &count, sizeof(count)) == sizeof(count));  //reset the eventfd
+	DCCRing ring(lc.ring, lc.slots);
+	dcclococommand c;
+	uint32_t run = 0;
+	do {
+		int r;
+		while ((r = ring.next(lc.tail, c)) > 0) {
+			ring.done(lc.tail++, runLocal(c).result);
+			localcommands++;
+			if (++run == lc.slots) {
+				count = 1;
+				if (write(lc.doorbell, &count, sizeof(count)) != sizeof(count)) perror("eventfd");
+				return true;
+			}
+		}
+		if (r < 0) return false;
+	} while (ring.arm(lc.tail));
+	return true;
+}
+
+//runs the client's messages.  Returns false when the client has hung up or the connection has
+//failed:
+bool readLocal(int fd, localclient &lc)
+{
+	char buf[sizeof(dcclocalheader) + DCCLOCAL_MAXRECORDS * sizeof(dcclococommand)];
+	char reply[sizeof(dcclocalheader) + DCCLOCAL_MAXRECORDS * sizeof(dcclocostatus)];
+	for (;;) {
+		ssize_t n = recv(fd, buf, sizeof(buf), 0);
+		if (n == 0) return false;
+		if (n < 0) {
+			if (errno == EINTR) continue;
+			return (errno == EAGAIN) | (errno == EWOULDBLOCK);
+		}
+		if ((size_t) n < sizeof(dcclocalheader)) continue;
+		dcclocalheader *h = (dcclocalheader *) buf;
+		if (h->op == DCCLOCAL_RING) {
+			setupRing(fd, lc, h->count);
+			continue;
+		}
+		if ((h->op != DCCLOCAL_COMMANDS) | (h->count > DCCLOCAL_MAXRECORDS) 
+		    | ((size_t) n != sizeof(dcclocalheader) + h->count * sizeof(dcclococommand))) 
+			continue;
+
+		dcclococommand *c = (dcclococommand *) (buf + sizeof(dcclocalheader));
+		dcclocostatus *st = (dcclocostatus *) (reply + sizeof(dcclocalheader));
+		for (unsigned i=0; i<h->count; i++) st[i] = runLocal(c[i]);
+		localcommands += h->count;
+		*(dcclocalheader *) reply = dcclocalheader{ DCCLOCAL_STATUS, h->count };
+		if (send(fd, reply, sizeof(dcclocalheader) + h->count * sizeof(dcclocostatus), MSG_NOSIGNAL | MSG_DONTWAIT) < 0) 
+			localdropped++;
+	}
+}
 
 // Main
 int main(int argc, char **argv)
@@ -169,11 +1235,48 @@ int main(int argc, char **argv)
 	bool daemon = false;
 	int opt;
     
-	while ((opt = getopt(argc, argv, "d")) != -1) {
+	while ((opt = getopt(argc, argv, "dq:o:c:r:u:l:b:")) != -1) {
 		switch (opt) {
 			case 'd':
 				daemon = true;
 				break;
+			case 'q':
+				outqueue_max = atoi(optarg);
+				break;
+			case 'c':
+				coalesce_ms = atoi(optarg);
+				break;
+			case 'u':
+				udpport = optarg;
+				break;
+			case 'l':
+				localpath = optarg;
+				break;
+			case 'b':
+				binaryport = optarg;
+				break;
+			case 'r': {
+				std::string r(optarg);
+				size_t eq = r.find('='), slash = r.find('/');
+				int i;
+				for (i=0; i<RATE_CLASSES; i++) if (r.substr(0, eq) == ratenames[i]) break;
+				if ((eq == std::string::npos) | (i == RATE_CLASSES)) {
+					fprintf(stderr, "wavedccd: -r is speed|function|other=rate[/burst]\n");
+					exit(1);
+				}
+				ratelimits[i].rate = atof(r.substr(eq+1).c_str());
+				ratelimits[i].burst = (slash == std::string::npos) ? ratelimits[i].rate : atof(r.substr(slash+1).c_str());
+				if (ratelimits[i].burst < 1.0) ratelimits[i].burst = 1.0;
+				break;
+			}
+			case 'o':
+				if (std::string(optarg) == "drop") outqueue_policy = OUTPUT_DROP;
+				else if (std::string(optarg) == "disconnect") outqueue_policy = OUTPUT_DISCONNECT;
+				else {
+					fprintf(stderr, "wavedccd: -o is drop or disconnect\n");
+					exit(1);
+				}
+				break;
 		}
 	}
                
@@ -187,111 +1290,144 @@ int main(int argc, char **argv)
 
     int listener;     // Listening socket descriptor
 
-    int newfd;        // Newly accept()ed socket descriptor
-    struct sockaddr_storage remoteaddr; // Client address
-    socklen_t addrlen;
-
-    char buf[256];    // Buffer for client data
-
-    char remoteIP[INET6_ADDRSTRLEN];
-
-    // Start off with room for 5 connections
-    // (We'll realloc as necessary)
-    int fd_count = 0;
-    int fd_size = 5;
-    struct pollfd *pfds = (pollfd *) malloc(sizeof *pfds * fd_size);
-
     // Set up and get a listening socket
-    listener = get_listener_socket();
+    listener = get_listener_socket(PORT);
 
     if (listener == -1) {
         fprintf(stderr, "error getting listening socket\n");
         exit(1);
     }
 
-    // Add the listener to set
-    pfds[0].fd = listener;
-    pfds[0].events = POLLIN; // Report ready to read on incoming connection
+    epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (epfd == -1) {
+        perror("epoll_create1");
+        exit(1);
+    }
+
+    struct epoll_event ev, events[MAXEVENTS];
+    ev.events = EPOLLIN | EPOLLET;
+    ev.data.fd = listener;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, listener, &ev);
+
+    int binarylistener = -1;
+    if (binaryport) {
+        binarylistener = get_listener_socket(binaryport);
+        if (binarylistener == -1) {
+            fprintf(stderr, "error getting binary listening socket\n");
+            exit(1);
+        }
+        ev.events = EPOLLIN | EPOLLET;
+        ev.data.fd = binarylistener;
+        epoll_ctl(epfd, EPOLL_CTL_ADD, binarylistener, &ev);
+    }
+
+    if (localpath) {
+        localfd = get_local_socket(localpath);
+        if (localfd == -1) {
+            fprintf(stderr, "error getting local socket %s\n", localpath);
+            exit(1);
+        }
+        ev.events = EPOLLIN | EPOLLET;
+        ev.data.fd = localfd;
+        epoll_ctl(epfd, EPOLL_CTL_ADD, localfd, &ev);
+    }
+
+    if (udpport) {
+        udpfd = get_udp_socket(udpport);
+        if (udpfd == -1) {
+            fprintf(stderr, "error getting UDP socket\n");
+            exit(1);
+        }
+        ev.events = EPOLLIN | EPOLLET;
+        ev.data.fd = udpfd;
+        epoll_ctl(epfd, EPOLL_CTL_ADD, udpfd, &ev);
+    }
 
-    fd_count = 1; // For the listener
+    wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    ev.events = EPOLLIN | EPOLLET;
+    ev.data.fd = wakefd;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, wakefd, &ev);
+    std::thread(worker).detach();
 
     // Main loop
+    int timeout = -1;  //the next locomotive state broadcast or held speed command
     for(;;) {
-        int poll_count = poll(pfds, fd_count, -1);
+        int n = epoll_wait(epfd, events, MAXEVENTS, (ready.size() > 0) ? 0 : timeout);
+        pass++;
 
-        if (poll_count == -1) {
-            perror("poll");
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            perror("epoll_wait");
             exit(1);
         }
 
-        // Run through the existing connections looking for data to read
-        for(int i = 0; i < fd_count; i++) {
-
-            // Check if someone's ready to read
-            if (pfds[i].revents & POLLIN) { // We got one!!
-
-                if (pfds[i].fd == listener) {
-                    // If listener is ready to read, handle new connection
-
-                    addrlen = sizeof remoteaddr;
-                    newfd = accept(listener,
-                        (struct sockaddr *)&remoteaddr,
-                        &addrlen);
-
-                    if (newfd == -1) {
-                        perror("accept");
-                    } else {
-                        add_to_pfds(&pfds, newfd, &fd_count, &fd_size);
-
-                        printf("wavedccd: new connection from %s on "
-                            "socket %d\n",
-                            inet_ntop(remoteaddr.ss_family,
-                                get_in_addr((struct sockaddr*)&remoteaddr),
-                                remoteIP, INET6_ADDRSTRLEN),
-                            newfd);
-                    }
-                } else {
-                    // If not the listener, we're just a regular client
-                    int nbytes = recv(pfds[i].fd, buf, sizeof buf, 0);
-
-                    int sender_fd = pfds[i].fd;
-
-                    if (nbytes <= 0) {
-                        // Got error or connection closed by client
-                        if (nbytes == 0) {
-                            // Connection closed
-                            printf("wavedccd: socket %d hung up\n", sender_fd);
-                        } else {
-                            perror("recv");
-                        }
-
-                        close(pfds[i].fd); // Bye!
-
-                        del_from_pfds(pfds, i, &fd_count);
-
-                    } else {
-                    
-                        //wavedccd-specific:
-                        buf[nbytes] = '\0';
-			std::string cmd = std::string(buf);
-			cmd.erase(cmd.find_last_not_of(" \n\r\t")+1);
-			std::string response = dccCommand(cmd); 
-			if (response.find("<p") == std::string::npos) {  //reply only to sender
-				send(sender_fd, response.c_str(), response.size(), 0);
-			}
-			else { //power state command, send response to everyone
-				for(int j = 0; j < fd_count; j++) {
-					int dest_fd = pfds[j].fd;
-					if (dest_fd != listener) {
-						send(dest_fd, response.c_str(), response.size(), 0);
-					}
-				}
-			}
-			
-                    }
-                } // END handle data from client
-            } // END got ready-to-read from poll()
-        } // END looping through file descriptors
+        for (int i = 0; i < n; i++) {
+            int fd = events[i].data.fd;
+
+            if (fd == listener) {
+                acceptClients(listener, false);
+                continue;
+            }
+            if (fd == wakefd) {
+                runResults();
+                continue;
+            }
+            if (fd == udpfd) {
+                readUDP();
+                continue;
+            }
+            if (fd == binarylistener) {
+                acceptClients(binarylistener, true);
+                continue;
+            }
+            if (fd == localfd) {
+                acceptLocals();
+                continue;
+            }
+            std::map<int, int>::iterator b = doorbells.find(fd);
+            if (b != doorbells.end()) {
+                if (!runRing(locals[b->second])) {
+                    fprintf(stderr, "wavedccd: local socket %d broke its ring, disconnecting\n", b->second);
+                    disconnectLocal(b->second);
+                }
+                continue;
+            }
+            std::map<int, localclient>::iterator l = locals.find(fd);
+            if (l != locals.end()) {
+                if (!readLocal(fd, l->second)) disconnectLocal(fd);
+                continue;
+            }
+
+            std::map<int, client>::iterator c = clients.find(fd);
+            if (c == clients.end()) continue;
+            client &cl = c->second;
+
+            if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+                ready.erase(fd);
+                serve(fd, cl);
+            }
+            if (!flush(fd, cl)) cl.closing = true;
+        }
+
+        //the clients left over from the last pass, that this one's events haven't served:
+        std::set<int> again;
+        again.swap(ready);
+        for (std::set<int>::iterator r = again.begin(); r != again.end(); r++) {
+            client &cl = clients[*r];
+            if (cl.served == pass) ready.insert(*r);
+            else if (!cl.closing & !cl.busy) {
+                serve(*r, cl);
+                if (!flush(*r, cl)) cl.closing = true;
+            }
+        }
+
+        timeout = soonest(runDeferred(), runBroadcasts());
+
+        //the clients that hung up, failed or overflowed their queues, whatever event found them:
+        for (std::map<int, client>::iterator c = clients.begin(); c != clients.end(); ) {
+            int fd = (c++)->first;
+            if (clients[fd].closing) disconnect(fd);
+        }
     } // END for(;;)--and you thought it would never end!
 
     //wavedccd-specific:
@@ -299,4 +1435,3 @@ int main(int argc, char **argv)
     
     return 0;
 }
-